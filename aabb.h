@@ -0,0 +1,97 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+// axis aligned bounding box, just three intervals one per axis
+// every hittable gives one of these so the bvh can skip whole groups of objects
+class aabb {
+public:
+    interval x, y, z;
+
+    aabb() {} // default box is empty since intervals are empty by default
+
+    aabb(const interval& x, const interval& y, const interval& z) : x(x), y(y), z(z) {
+        pad_to_minimums();
+    }
+
+    // box from two corner points, order of the corners doesn't matter
+    aabb(const point3& a, const point3& b) {
+        x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
+        y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
+        z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+        pad_to_minimums();
+    }
+
+    // box enclosing two boxes
+    aabb(const aabb& box0, const aabb& box1)
+        : x(box0.x, box1.x), y(box0.y, box1.y), z(box0.z, box1.z) {}
+
+    const interval& axis_interval(int n) const {
+        if (n == 1) return y;
+        if (n == 2) return z;
+        return x;
+    }
+
+    bool is_empty() const { return x.min > x.max || y.min > y.max || z.min > z.max; }
+
+    point3 centroid() const {
+        return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+    }
+
+    // used by the SAH build, cost of a node is proportional to its area
+    double surface_area() const {
+        if (is_empty()) return 0;
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // longest side of the box (0 = x, 1 = y, 2 = z)
+    int longest_axis() const {
+        if (x.size() > y.size())
+            return x.size() > z.size() ? 0 : 2;
+        return y.size() > z.size() ? 1 : 2;
+    }
+
+    // slab test, shrink ray_t by each axis and see if anything is left
+    bool hit(const ray& r, interval ray_t) const {
+        const point3& ray_orig = r.origin();
+        const vec3& ray_dir = r.direction();
+
+        for (int axis = 0; axis < 3; axis++) {
+            const interval& ax = axis_interval(axis);
+            const real adinv = 1 / ray_dir[axis];
+
+            auto t0 = (ax.min - ray_orig[axis]) * adinv;
+            auto t1 = (ax.max - ray_orig[axis]) * adinv;
+
+            if (t0 < t1) {
+                if (t0 > ray_t.min) ray_t.min = t0;
+                if (t1 < ray_t.max) ray_t.max = t1;
+            } else {
+                if (t1 > ray_t.min) ray_t.min = t1;
+                if (t0 < ray_t.max) ray_t.max = t0;
+            }
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        return true;
+    }
+
+    static const aabb empty, universe;
+
+private:
+    // flat boxes (zero radius sphere etc.) get a tiny thickness so the slab test still works
+    void pad_to_minimums() {
+        real delta = real(0.0001);
+        if (x.size() < delta) x = x.expand(delta);
+        if (y.size() < delta) y = y.expand(delta);
+        if (z.size() < delta) z = z.expand(delta);
+    }
+};
+
+const aabb aabb::empty    = aabb(interval::empty,    interval::empty,    interval::empty);
+const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
+
+#endif
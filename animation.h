@@ -0,0 +1,144 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "scene_cache.h"
+#include "scene_file.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+// rendering all frames of an animated text scene in one process: the scene is parsed and
+// its bvh built once, every frame only moves the keyed spheres and refits the bvh, and
+// frames are written by a background thread while the next one renders
+
+// output path of one frame: the first run of '#' in pattern becomes the frame number with
+// that many digits (frame_###.png -> frame_007.png), without any '#' "_0007" goes in front
+// of the extension
+inline std::string frame_path(const std::string& pattern, int frame) {
+    auto first = pattern.find('#');
+    if (first == std::string::npos) {
+        auto dot = pattern.find_last_of('.');
+        auto slash = pattern.find_last_of('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = pattern.size();
+        return frame_path(pattern.substr(0, dot) + "_####" + pattern.substr(dot), frame);
+    }
+
+    auto last = pattern.find_first_not_of('#', first);
+    if (last == std::string::npos) last = pattern.size();
+    char number[32];
+    std::snprintf(number, sizeof(number), "%0*d", int(last - first), frame);
+    return pattern.substr(0, first) + number + pattern.substr(last);
+}
+
+// sets the camera and the keyed sphere centers of scene to their values at frame,
+// true if a sphere moved (so the bvh needs a refit)
+inline bool apply_frame(scene_description& scene, int frame) {
+    bool spheres_moved = false;
+    for (const auto& track : scene.tracks) {
+        vec3 value = track.at(frame);
+        switch (track.target) {
+            case track_target::lookfrom: scene.camera.lookfrom = value; break;
+            case track_target::lookat:   scene.camera.lookat = value; break;
+            case track_target::sphere_center:
+                scene.spheres[track.sphere_index].center = value;
+                spheres_moved = true;
+                break;
+        }
+    }
+    return spheres_moved;
+}
+
+// writes frames on its own thread. at most one frame waits while another is being written,
+// so a slow encoder makes the renderer wait instead of piling up framebuffers
+class frame_writer {
+public:
+    frame_writer() : worker([this] { run(); }) {}
+    ~frame_writer() { finish(); }
+
+    frame_writer(const frame_writer&) = delete;
+    frame_writer& operator=(const frame_writer&) = delete;
+
+    void write(framebuffer image, const std::string& path, image_format format) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !has_pending; });
+        pending = job{ std::move(image), path, format };
+        has_pending = true;
+        changed.notify_all();
+    }
+
+    // waits until every frame is written, false if any of them failed
+    bool finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        if (worker.joinable()) worker.join();
+        return all_ok;
+    }
+
+private:
+    struct job {
+        framebuffer image;
+        std::string path;
+        image_format format = image_format::ppm;
+    };
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    job pending;
+    bool has_pending = false;
+    bool stopping = false;
+    bool all_ok = true; // only touched by the worker until it's joined
+    std::thread worker; // last, it starts running in the constructor
+
+    void run() {
+        while (true) {
+            job current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this] { return has_pending || stopping; });
+                if (!has_pending) return;
+                current = std::move(pending);
+                has_pending = false;
+            }
+            changed.notify_all();
+            if (!write_image(current.image, current.path, current.format)) all_ok = false;
+        }
+    }
+};
+
+// renders frames 0 .. scene.frame_count - 1 of world (built from scene) to frame_path(pattern, i).
+// setup gets every frame's camera after the scene's settings are applied
+inline bool render_animation(scene_description& scene, flat_scene& world, const std::string& pattern,
+                             image_format format, const std::function<void(camera&)>& setup) {
+    frame_writer writer;
+    for (int frame = 0; frame < scene.frame_count; frame++) {
+        if (apply_frame(scene, frame)) world.refit();
+
+        camera frame_camera;
+        scene.camera.apply(frame_camera);
+        setup(frame_camera);
+        if (frame_camera.show_progress)
+            std::clog << "Frame " << frame + 1 << " of " << scene.frame_count << '\n';
+
+        framebuffer image = frame_camera.render_image(world);
+        if (frame_camera.last_render_failed()) {
+            writer.finish();
+            return false;
+        }
+        writer.write(std::move(image), frame_path(pattern, frame), format);
+    }
+    return writer.finish();
+}
+
+#endif
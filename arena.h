@@ -0,0 +1,134 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// storage for the objects of a scene (spheres, materials, ...) in big blocks instead of one
+// heap allocation each. every type gets blocks of its own, so all spheres sit next to each
+// other in the order they were made, and so do all lambertians etc., with no control block
+// or allocator header between them
+//
+// make<T>() hands out a shared_ptr<T> like make_shared does, so whatever takes shared_ptrs
+// (hittable_list, material_table, bvh_node) works unchanged. the pointers don't own their
+// object but the whole arena: they all share one reference count, and the arena with every
+// object in it is freed when the last of them (or the scene_arena itself) goes away. a
+// scene can make its objects from a local arena and return, the list keeps them alive.
+// single objects are never freed on their own, and a copy costs an atomic increment on a
+// counter every handle shares, so it's meant for things that live as long as the scene.
+// an object in the arena must not keep a handle of its own arena (an instance_set holding
+// a mesh made by the same arena), that count would never reach zero. make() is for one
+// thread at a time, like building a hittable_list
+class scene_arena {
+public:
+    scene_arena() : state(std::make_shared<pools>()) {}
+
+    // constructs a T in the arena, it lives until the arena and every handle are gone
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make(Args&&... args) {
+        T* object = pool_for<T>().make(std::forward<Args>(args)...);
+        return std::shared_ptr<T>(state, object); // aliasing: shares the arena's count
+    }
+
+    // room for count more T in one block, so a big batch of one type stays contiguous
+    template <typename T>
+    void reserve(size_t count) { pool_for<T>().reserve(count); }
+
+    // bytes taken by blocks (objects plus unused room at the end of the last blocks)
+    size_t bytes_reserved() const {
+        size_t bytes = 0;
+        for (const auto& p : state->by_type)
+            if (p) bytes += p->bytes_reserved();
+        return bytes;
+    }
+
+private:
+    static constexpr size_t block_alignment = 64;        // a cache line
+    static constexpr size_t max_block_bytes = 1 << 20;  // blocks double up to this size
+
+    struct pool_base {
+        virtual ~pool_base() = default;
+        virtual size_t bytes_reserved() const = 0;
+    };
+
+    // the blocks of one type, objects are destroyed in reverse order when the arena goes
+    template <typename T>
+    struct typed_pool : pool_base {
+        struct block {
+            T* objects;
+            size_t used, capacity;
+        };
+        std::vector<block> blocks;
+
+        ~typed_pool() override {
+            for (auto b = blocks.rbegin(); b != blocks.rend(); ++b) {
+                for (size_t i = b->used; i-- > 0;)
+                    b->objects[i].~T();
+                ::operator delete(b->objects, std::align_val_t(block_alignment));
+            }
+        }
+
+        template <typename... Args>
+        T* make(Args&&... args) {
+            if (blocks.empty() || blocks.back().used == blocks.back().capacity) {
+                size_t previous = blocks.empty() ? 8 : blocks.back().capacity;
+                size_t limit = std::max<size_t>(1, max_block_bytes / sizeof(T));
+                add_block(std::min(2 * previous, limit));
+            }
+            block& b = blocks.back();
+            T* object = new (b.objects + b.used) T(std::forward<Args>(args)...);
+            b.used++; // after the constructor, a throwing one leaves nothing to destroy
+            return object;
+        }
+
+        void reserve(size_t count) {
+            if (!blocks.empty() && blocks.back().capacity - blocks.back().used >= count) return;
+            add_block(count);
+        }
+
+        void add_block(size_t capacity) {
+            void* memory = ::operator new(capacity * sizeof(T), std::align_val_t(block_alignment));
+            blocks.push_back({ static_cast<T*>(memory), 0, capacity });
+        }
+
+        size_t bytes_reserved() const override {
+            size_t bytes = 0;
+            for (const auto& b : blocks) bytes += b.capacity * sizeof(T);
+            return bytes;
+        }
+    };
+
+    struct pools {
+        std::vector<std::unique_ptr<pool_base>> by_type; // indexed by type_slot<T>()
+    };
+
+    // a small number per type, handed out the first time a type is used
+    static size_t next_slot() {
+        static std::atomic<size_t> slots{0};
+        return slots++;
+    }
+
+    template <typename T>
+    static size_t type_slot() {
+        static const size_t slot = next_slot();
+        return slot;
+    }
+
+    template <typename T>
+    typed_pool<T>& pool_for() {
+        size_t slot = type_slot<T>();
+        auto& by_type = state->by_type;
+        if (by_type.size() <= slot) by_type.resize(slot + 1);
+        if (!by_type[slot]) by_type[slot] = std::make_unique<typed_pool<T>>();
+        return static_cast<typed_pool<T>&>(*by_type[slot]);
+    }
+
+    std::shared_ptr<pools> state;
+};
+
+#endif
@@ -0,0 +1,761 @@
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_soa.h"
+#include "arena.h"
+#include "bvh.h"
+#include "camera.h"
+#include "scenes.h"
+#include "static_scene.h"
+#include "triangle_mesh.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// performance measurements
+//   micro      - sphere::hit, hittable_list::hit, sphere_soa (scalar and simd), the three
+//                material scatter calls and random_unit_vector, in calls per second
+//   end to end - the main scene (virtual and std::variant dispatch, iterative and wavefront
+//                paths, the samplers), random sphere scenes with 10 / 1k / 100k spheres, a triangle mesh
+//                of 500k triangles and 1M instances of one mesh, in rays and samples per second
+//
+// every run prints a table, --json writes the same numbers as json and --baseline compares
+// against such a file (exit code 1 if anything got slower than the tolerance allows):
+//   ./bench --json bench_baseline.json      # store a baseline
+//   ./bench --baseline bench_baseline.json  # after a change
+//
+// build with the same flags as the renderer, e.g.
+//   g++ -std=c++17 -O2 -march=native -pthread -o bench bench.cpp
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// runs pass() until at least min_seconds went by, so even the fast kernels are timed over
+// long enough to be steady. returns the seconds per pass
+template <typename Pass>
+static double time_passes(Pass&& pass, double min_seconds = 0.25) {
+    int passes = 0;
+    auto start = bench_clock::now();
+    double elapsed;
+    do {
+        pass();
+        passes++;
+        elapsed = seconds_since(start);
+    } while (elapsed < min_seconds);
+    return elapsed / passes;
+}
+
+// one line of the report. micro benchmarks count operations (calls of the measured
+// function) and their wall time is per pass, renders count rays (scene intersections)
+// and camera samples
+struct bench_result {
+    std::string name;
+    double wall_seconds = 0;
+    double operations = 0;
+    double rays = 0;
+    double samples = 0;
+
+    double ops_per_second() const { return operations / wall_seconds; }
+    double rays_per_second() const { return rays / wall_seconds; }
+    double samples_per_second() const { return samples / wall_seconds; }
+
+    // the number a baseline comparison looks at
+    double throughput() const { return rays > 0 ? rays_per_second() : ops_per_second(); }
+};
+
+struct bench_options {
+    std::string filter;        // only benchmarks whose name contains this
+    std::string json_path;     // write results here
+    std::string baseline_path; // compare against this
+    double tolerance = 0.10;   // allowed slowdown before a result counts as a regression
+    int thread_count = 1;      // for the renders, 1 gives the steadiest numbers
+};
+
+class bench_suite {
+public:
+    explicit bench_suite(const bench_options& options) : options(options) {}
+
+    bool selected(const std::string& name) const {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    void add(const bench_result& result) {
+        results.push_back(result);
+        if (result.rays > 0)
+            std::printf("  %-30s %8.3f s  %8.2f M rays/s  %7.3f M samples/s\n", result.name.c_str(),
+                        result.wall_seconds, result.rays_per_second() * 1e-6, result.samples_per_second() * 1e-6);
+        else
+            std::printf("  %-30s %8.2f ns   %8.1f M calls/s\n", result.name.c_str(),
+                        result.wall_seconds / result.operations * 1e9, result.ops_per_second() * 1e-6);
+        std::fflush(stdout);
+    }
+
+    // a correctness check next to a benchmark failed, the run still finishes but exits with 1
+    void fail(const std::string& message) {
+        std::printf("  FAILED: %s\n", message.c_str());
+        failed = true;
+    }
+
+    const bench_options& settings() const { return options; }
+
+    // writes the json report and compares with the baseline, false if anything failed
+    bool finish() {
+        bool ok = !failed;
+        if (!options.json_path.empty()) ok = write_json(options.json_path) && ok;
+        if (!options.baseline_path.empty()) ok = compare_baseline(options.baseline_path) && ok;
+        return ok;
+    }
+
+private:
+    bench_options options;
+    std::vector<bench_result> results;
+    bool failed = false;
+
+    static const char* precision_name() { return sizeof(real) == sizeof(float) ? "float" : "double"; }
+
+    // one result per line so the baseline reader below doesn't need a real json parser
+    bool write_json(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) {
+            std::fprintf(stderr, "could not open %s for writing\n", path.c_str());
+            return false;
+        }
+
+        char line[512];
+        out << "{\n";
+        std::snprintf(line, sizeof(line), "  \"build\": {\"real\": \"%s\", \"simd\": \"%s\", \"threads\": %d},\n",
+                      precision_name(), simd_name(), options.thread_count);
+        out << line << "  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const auto& r = results[i];
+            std::snprintf(line, sizeof(line),
+                          "    {\"name\": \"%s\", \"wall_s\": %.6g, \"ops_per_s\": %.6g, \"rays_per_s\": %.6g, "
+                          "\"samples_per_s\": %.6g}%s\n",
+                          r.name.c_str(), r.wall_seconds, r.operations > 0 ? r.ops_per_second() : 0.0,
+                          r.rays > 0 ? r.rays_per_second() : 0.0, r.samples > 0 ? r.samples_per_second() : 0.0,
+                          i + 1 < results.size() ? "," : "");
+            out << line;
+        }
+        out << "  ]\n}\n";
+        return bool(out);
+    }
+
+    // value of "key": number on a line written by write_json
+    static bool json_number(const std::string& line, const std::string& key, double& value) {
+        auto pos = line.find("\"" + key + "\": ");
+        if (pos == std::string::npos) return false;
+        value = std::atof(line.c_str() + pos + key.size() + 4);
+        return true;
+    }
+
+    static bool json_string(const std::string& line, const std::string& key, std::string& value) {
+        auto pos = line.find("\"" + key + "\": \"");
+        if (pos == std::string::npos) return false;
+        pos += key.size() + 5;
+        auto end = line.find('"', pos);
+        if (end == std::string::npos) return false;
+        value = line.substr(pos, end - pos);
+        return true;
+    }
+
+    bool compare_baseline(const std::string& path) const {
+        std::ifstream in(path);
+        if (!in) {
+            std::fprintf(stderr, "could not open baseline %s\n", path.c_str());
+            return false;
+        }
+
+        // throughput per benchmark name, the same metric bench_result::throughput() gives
+        std::map<std::string, double> baseline;
+        std::string line;
+        while (std::getline(in, line)) {
+            std::string precision, simd;
+            if (json_string(line, "real", precision) && json_string(line, "simd", simd) &&
+                (precision != precision_name() || simd != simd_name()))
+                std::printf("\nnote: the baseline is from a %s/%s build, this is %s/%s\n",
+                            precision.c_str(), simd.c_str(), precision_name(), simd_name());
+
+            std::string name;
+            double rays = 0, ops = 0;
+            if (!json_string(line, "name", name)) continue;
+            json_number(line, "rays_per_s", rays);
+            json_number(line, "ops_per_s", ops);
+            baseline[name] = rays > 0 ? rays : ops;
+        }
+
+        std::printf("\ncompared to %s (%.0f%% tolerance)\n", path.c_str(), options.tolerance * 100);
+        bool ok = true;
+        for (const auto& r : results) {
+            auto it = baseline.find(r.name);
+            if (it == baseline.end() || it->second <= 0) {
+                std::printf("  %-30s   (not in baseline)\n", r.name.c_str());
+                continue;
+            }
+            double ratio = r.throughput() / it->second;
+            bool regressed = ratio < 1 - options.tolerance;
+            std::printf("  %-30s %6.2fx%s\n", r.name.c_str(), ratio, regressed ? "  SLOWER" : "");
+            if (regressed) ok = false;
+        }
+        return ok;
+    }
+};
+
+// ---------------------------------------------------------------------------------------
+// micro benchmarks
+
+// random spheres and rays shared by the intersection benchmarks
+struct intersection_data {
+    static constexpr int sphere_count = 64;
+    static constexpr int ray_count = 200000;
+
+    material_table materials;
+    std::vector<sphere> spheres;
+    hittable_list list;
+    sphere_soa soa;
+    std::vector<ray> rays;
+
+    intersection_data() {
+        seed_sample_rng(0, 0, 0);
+        auto m = materials.add(make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+        spheres.reserve(sphere_count);
+        for (int i = 0; i < sphere_count; i++) {
+            point3 center = vec3::random(-10, 10);
+            real radius = random_double(0.2, 1.5);
+            spheres.emplace_back(center, radius, m);
+            list.add(make_shared<sphere>(center, radius, m));
+            soa.add(center, radius, m);
+        }
+
+        rays.reserve(ray_count);
+        for (int i = 0; i < ray_count; i++)
+            rays.emplace_back(vec3::random(-12, 12), random_unit_vector());
+    }
+};
+
+static void bench_intersection(bench_suite& suite) {
+    intersection_data data;
+    const interval ray_t(0.001, infinity);
+    const double tests = double(data.sphere_count) * data.ray_count;
+
+    // each kernel sums its hit t's so the work can't be optimized away and results can be compared
+    double direct_sum = 0, list_sum = 0, soa_scalar_sum = 0, simd_sum = 0;
+
+    // the sums are reset every pass, the last pass is the one compared
+    if (suite.selected("sphere::hit")) {
+        double seconds = time_passes([&] {
+            direct_sum = 0;
+            for (const auto& r : data.rays) {
+                hit_record rec;
+                interval t = ray_t;
+                bool any = false;
+                // called on the objects themselves, so no virtual dispatch, like static_scene
+                for (const auto& s : data.spheres) {
+                    if (s.sphere::hit(r, t, rec)) {
+                        t.max = rec.hit_t;
+                        any = true;
+                    }
+                }
+                if (any) direct_sum += rec.hit_t;
+            }
+        });
+        suite.add({ "sphere::hit", seconds, tests });
+    }
+
+    if (suite.selected("hittable_list::hit")) {
+        double seconds = time_passes([&] {
+            list_sum = 0;
+            for (const auto& r : data.rays) {
+                hit_record rec;
+                if (data.list.hit(r, ray_t, rec)) list_sum += rec.hit_t;
+            }
+        });
+        suite.add({ "hittable_list::hit", seconds, tests });
+    }
+
+    if (suite.selected("sphere_soa scalar")) {
+        double seconds = time_passes([&] {
+            soa_scalar_sum = 0;
+            for (const auto& r : data.rays) {
+                real t;
+                if (data.soa.closest_hit_scalar(r, ray_t, t, 0) >= 0) soa_scalar_sum += t;
+            }
+        });
+        suite.add({ "sphere_soa scalar", seconds, tests });
+    }
+
+    std::string simd_label = std::string("sphere_soa ") + sphere_soa::kernel_name();
+    if (suite.selected(simd_label)) {
+        double seconds = time_passes([&] {
+            simd_sum = 0;
+            for (const auto& r : data.rays) {
+                real t;
+                if (data.soa.closest_hit(r, ray_t, t) >= 0) simd_sum += t;
+            }
+        });
+        suite.add({ simd_label, seconds, tests });
+    }
+
+    // every kernel that ran is compared with the first one that ran, a sum of 0 included:
+    // 200k rays into 64 spheres always hit something, so 0 means a broken kernel. with
+    // -march=native the compiler may fuse the scalar multiply-adds, so allow rounding noise
+    const double tolerance = sizeof(real) == sizeof(float) ? 1e-4 : 1e-9;
+    const std::pair<bool, double> kernels[] = {
+        { suite.selected("sphere::hit"), direct_sum },
+        { suite.selected("hittable_list::hit"), list_sum },
+        { suite.selected("sphere_soa scalar"), soa_scalar_sum },
+        { suite.selected(simd_label), simd_sum },
+    };
+    const std::pair<bool, double>* reference = nullptr;
+    bool mismatch = false;
+    for (const auto& k : kernels) {
+        if (!k.first) continue;
+        if (!reference) reference = &k;
+        mismatch = mismatch || k.second == 0 || std::fabs(k.second - reference->second) > tolerance * std::fabs(reference->second);
+    }
+    if (mismatch) {
+        char message[256];
+        std::snprintf(message, sizeof(message), "intersection results differ or found nothing: %.17g %.17g %.17g %.17g",
+                      direct_sum, list_sum, soa_scalar_sum, simd_sum);
+        suite.fail(message);
+    }
+}
+
+// scatter calls on hit records of real hits, through the material base class like the
+// renderer's virtual path does
+static void bench_scatter(bench_suite& suite) {
+    const int record_count = 4096;
+
+    seed_sample_rng(1, 0, 0);
+    sphere target(point3(0, 0, 0), 1, 0);
+    std::vector<ray> rays;
+    std::vector<hit_record> records;
+    while (int(records.size()) < record_count) {
+        // rays from outside (and some from inside, for the dielectric's other branch)
+        bool inside = records.size() % 4 == 3;
+        point3 origin = inside ? 0.5 * random_unit_vector() : 4 * random_unit_vector();
+        ray r(origin, inside ? random_unit_vector() : vec3::random(-0.5, 0.5) - origin);
+        hit_record rec;
+        if (!target.intersect(r, interval(0, infinity), rec)) continue;
+        rays.push_back(r);
+        records.push_back(rec);
+    }
+
+    const std::pair<const char*, shared_ptr<material>> materials[] = {
+        { "lambertian::scatter", make_shared<lambertian>(color(0.5, 0.5, 0.5)) },
+        { "metal::scatter", make_shared<metal>(color(0.8, 0.8, 0.8), 0.2) },
+        { "dielectric::scatter", make_shared<dielectric>(1.5) },
+    };
+
+    for (const auto& entry : materials) {
+        if (!suite.selected(entry.first)) continue;
+        const material& m = *entry.second;
+
+        double checksum = 0;
+        double seconds = time_passes([&] {
+            for (int i = 0; i < record_count; i++) {
+                color attenuation;
+                ray scattered;
+                if (m.scatter(rays[i], records[i], attenuation, scattered))
+                    checksum += scattered.direction().x();
+            }
+        });
+        suite.add({ entry.first, seconds, double(record_count) });
+        if (checksum == 12345.678) std::printf(" "); // keeps the loop from being dropped
+    }
+}
+
+static void bench_random_unit_vector(bench_suite& suite) {
+    if (!suite.selected("random_unit_vector")) return;
+    const int count = 100000;
+
+    seed_sample_rng(2, 0, 0);
+    vec3 sum;
+    double seconds = time_passes([&] {
+        for (int i = 0; i < count; i++)
+            sum += random_unit_vector();
+    });
+    suite.add({ "random_unit_vector", seconds, double(count) });
+    if (sum.x() == 12345.678) std::printf(" ");
+}
+
+// ---------------------------------------------------------------------------------------
+// end to end renders
+
+// passes everything through to Scene and counts intersect calls, i.e. rays traced
+template <class Scene>
+class counting_scene {
+public:
+    explicit counting_scene(const Scene& scene) : scene(scene) {}
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const {
+        ray_count.fetch_add(1, std::memory_order_relaxed);
+        return scene.intersect(r, ray_t, rec);
+    }
+
+    bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const {
+        return scene.scatter(r, rec, attenuation, scattered);
+    }
+
+    color emitted(const ray& r, const hit_record& rec) const { return scene.emitted(r, rec); }
+
+    color base_color(const hit_record& rec) const { return scene.base_color(rec); }
+
+    bool has_pdf(const hit_record& rec) const { return scene.has_pdf(rec); }
+
+    bool is_mirror(const hit_record& rec) const { return scene.is_mirror(rec); }
+
+    uint32_t material_type(const hit_record& rec) const { return scene.material_type(rec); }
+
+    color evaluate(const ray& r, const hit_record& rec, const vec3& dir, real& pdf) const {
+        return scene.evaluate(r, rec, dir, pdf);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const {
+        ray_count.fetch_add(1, std::memory_order_relaxed);
+        return scene.occluded(r, ray_t);
+    }
+
+    const light_list& lights() const { return scene.lights(); }
+
+    double rays() const { return double(ray_count.load()); }
+
+private:
+    const Scene& scene;
+    mutable std::atomic<uint64_t> ray_count{0};
+};
+
+template <class Scene>
+static framebuffer bench_render(bench_suite& suite, const std::string& name, camera& cam, const Scene& scene) {
+    counting_scene<Scene> counted(scene);
+    cam.thread_count = suite.settings().thread_count;
+    cam.show_progress = false;
+
+    auto start = bench_clock::now();
+    framebuffer image = cam.render_image(counted);
+    double seconds = seconds_since(start);
+
+    double samples = double(image.width()) * image.height() * cam.samples_per_pixel;
+    suite.add({ name, seconds, 0, counted.rays(), samples });
+    return image;
+}
+
+// same scene, same camera, once through hittable/material virtual calls and once through
+// static_scene, the two images have to match exactly
+static void bench_main_scene(bench_suite& suite) {
+    bool run_virtual = suite.selected("main scene virtual");
+    bool run_static = suite.selected("main scene static");
+    if (!run_virtual && !run_static) return;
+
+    hittable_list objects;
+    material_table materials;
+    main_scene(objects, materials);
+
+    static_scene variant_scene;
+    if (!static_scene::from_virtual(objects, materials, variant_scene)) {
+        suite.fail("main scene can't be converted to a static_scene");
+        return;
+    }
+    hittable_list virtual_world(make_shared<bvh_node>(objects));
+
+    camera cam;
+    main_scene_camera(cam);
+    cam.image_width = 300;
+    cam.samples_per_pixel = 16;
+
+    framebuffer virtual_image, variant_image;
+    if (run_virtual)
+        virtual_image = bench_render(suite, "main scene virtual", cam, virtual_scene(virtual_world, materials));
+    if (run_static)
+        variant_image = bench_render(suite, "main scene static", cam, variant_scene);
+
+    if (run_virtual && run_static) {
+        size_t values = size_t(virtual_image.width()) * virtual_image.height() * 3;
+        for (size_t i = 0; i < values; i++) {
+            if (virtual_image.data()[i] != variant_image.data()[i]) {
+                suite.fail("virtual and static dispatch images differ");
+                break;
+            }
+        }
+    }
+}
+
+// iterative paths one at a time vs the same paths as a wavefront, images have to match
+static void bench_integrators(bench_suite& suite) {
+    bool run_iterative = suite.selected("main scene iterative");
+    bool run_wavefront = suite.selected("main scene wavefront");
+    if (!run_iterative && !run_wavefront) return;
+
+    hittable_list objects;
+    material_table materials;
+    main_scene(objects, materials);
+    static_scene variant_scene;
+    if (!static_scene::from_virtual(objects, materials, variant_scene)) {
+        suite.fail("main scene can't be converted to a static_scene");
+        return;
+    }
+
+    camera cam;
+    main_scene_camera(cam);
+    cam.image_width = 300;
+    cam.samples_per_pixel = 16;
+
+    framebuffer iterative_image, wavefront_image;
+    if (run_iterative) {
+        cam.path_integrator = integrator::iterative;
+        iterative_image = bench_render(suite, "main scene iterative", cam, variant_scene);
+    }
+    if (run_wavefront) {
+        cam.path_integrator = integrator::wavefront;
+        wavefront_image = bench_render(suite, "main scene wavefront", cam, variant_scene);
+    }
+
+    if (run_iterative && run_wavefront) {
+        size_t values = size_t(iterative_image.width()) * iterative_image.height() * 3;
+        for (size_t i = 0; i < values; i++) {
+            if (iterative_image.data()[i] != wavefront_image.data()[i]) {
+                suite.fail("iterative and wavefront images differ");
+                break;
+            }
+        }
+    }
+}
+
+// the main scene through static_scene with the other samplers (sampler.h), "main scene
+// static" is the independent one. rays per second tell what a sampler costs, the images
+// (better per sample) are compared with imgdiff, not here
+static void bench_samplers(bench_suite& suite) {
+    const std::pair<sampler_kind, const char*> samplers[] = {
+        { sampler_kind::stratified, "main scene stratified" },
+        { sampler_kind::sobol, "main scene sobol" },
+        { sampler_kind::blue_noise, "main scene blue noise" },
+    };
+    bool any = false;
+    for (const auto& s : samplers) any = any || suite.selected(s.second);
+    if (!any) return;
+
+    hittable_list objects;
+    material_table materials;
+    main_scene(objects, materials);
+    static_scene variant_scene;
+    if (!static_scene::from_virtual(objects, materials, variant_scene)) {
+        suite.fail("main scene can't be converted to a static_scene");
+        return;
+    }
+
+    camera cam;
+    main_scene_camera(cam);
+    cam.image_width = 300;
+    cam.samples_per_pixel = 16;
+    for (const auto& s : samplers) {
+        if (!suite.selected(s.second)) continue;
+        cam.sampler = s.first;
+        bench_render(suite, s.second, cam, variant_scene);
+    }
+}
+
+// count random spheres of all three materials above a big ground sphere, in a box that
+// grows with the count so the density (and the picture) stays about the same. with
+// use_arena the spheres and materials come from a scene_arena instead of one make_shared
+// each, same scene and same image
+static void bench_sphere_scene(bench_suite& suite, int count, const std::string& name, bool use_arena = false) {
+    if (!suite.selected(name)) return;
+
+    scene_arena arena;
+    auto make_sphere = [&](const point3& center, real radius, uint32_t material_id) -> shared_ptr<hittable> {
+        if (use_arena) return arena.make<sphere>(center, radius, material_id);
+        return make_shared<sphere>(center, radius, material_id);
+    };
+    auto make_material = [&](auto prototype) -> shared_ptr<material> {
+        using material_type = decltype(prototype);
+        if (use_arena) return arena.make<material_type>(prototype);
+        return make_shared<material_type>(prototype);
+    };
+    if (use_arena) arena.reserve<sphere>(size_t(count) + 1);
+
+    seed_sample_rng(3, 0, uint32_t(count));
+    hittable_list objects;
+    material_table materials;
+    objects.add(make_sphere(point3(0, -1000, 0), 1000, materials.add(make_material(lambertian(color(0.5, 0.5, 0.5))))));
+    uint32_t kinds[3] = {
+        materials.add(make_material(lambertian(color(0.8, 0.3, 0.3)))),
+        materials.add(make_material(metal(color(0.8, 0.8, 0.9), 0.1))),
+        materials.add(make_material(dielectric(1.5))),
+    };
+
+    real extent = real(2 * std::cbrt(double(count)));
+    for (int i = 0; i < count; i++) {
+        point3 center(random_double(-extent, extent), random_double(0.2, extent / 2),
+                      random_double(-extent, extent));
+        objects.add(make_sphere(center, random_double(0.2, 0.6), kinds[i % 3]));
+    }
+    hittable_list world(make_shared<bvh_node>(objects));
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 240;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 10;
+    cam.vfov = 50;
+    cam.lookfrom = point3(0, extent, -3 * extent);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    bench_render(suite, name, cam, virtual_scene(world, materials));
+}
+
+// torus of n x n quads (2 n^2 triangles) around the y axis, resting on y = 0
+static mesh_data torus_mesh(int n, real major, real minor) {
+    mesh_data torus;
+    for (int i = 0; i < n; i++) {
+        real u = real(2 * pi * i / n);
+        for (int j = 0; j < n; j++) {
+            real v = real(2 * pi * j / n);
+            real ring = major + minor * std::cos(v);
+            torus.vertices.push_back(point3(ring * std::cos(u), minor + minor * std::sin(v), ring * std::sin(u)));
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            uint32_t a = uint32_t(i * n + j), b = uint32_t((i + 1) % n * n + j);
+            uint32_t c = uint32_t((i + 1) % n * n + (j + 1) % n), d = uint32_t(i * n + (j + 1) % n);
+            torus.indices.insert(torus.indices.end(), { a, b, c, a, c, d });
+        }
+    }
+    return torus;
+}
+
+// a big torus standing on a ground sphere, the mesh and its bvh are built outside the timing
+static void bench_mesh_scene(bench_suite& suite, int n, const std::string& name) {
+    if (!suite.selected(name)) return;
+
+    mesh_data torus = torus_mesh(n, 2, real(0.7));
+
+    hittable_list objects;
+    material_table materials;
+    objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000,
+                                    materials.add(make_shared<lambertian>(color(0.5, 0.5, 0.5)))));
+    objects.add(make_shared<triangle_mesh>(std::move(torus), materials.add(make_shared<metal>(color(0.8, 0.6, 0.3), 0.2))));
+    hittable_list world(make_shared<bvh_node>(objects));
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 240;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 10;
+    cam.vfov = 40;
+    cam.lookfrom = point3(0, 5, -8);
+    cam.lookat = point3(0, 1, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    bench_render(suite, name, cam, virtual_scene(world, materials));
+}
+
+// a field of count randomly turned and scaled copies of one small torus mesh, as one
+// instance_set: a top level bvh over the instances and the mesh's own bvh below
+static void bench_instance_scene(bench_suite& suite, int count, const std::string& name) {
+    if (!suite.selected(name)) return;
+
+    seed_sample_rng(4, 0, uint32_t(count));
+    material_table materials;
+    uint32_t ground = materials.add(make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+    uint32_t kinds[3] = {
+        materials.add(make_shared<lambertian>(color(0.3, 0.6, 0.3))),
+        materials.add(make_shared<metal>(color(0.8, 0.8, 0.9), 0.1)),
+        materials.add(make_shared<lambertian>(color(0.7, 0.5, 0.2))),
+    };
+
+    instance_set field;
+    uint32_t prototypes[3];
+    for (int k = 0; k < 3; k++)
+        prototypes[k] = field.add_prototype(make_shared<triangle_mesh>(torus_mesh(16, real(0.4), real(0.15)), kinds[k]));
+
+    real extent = real(std::sqrt(double(count)));
+    for (int i = 0; i < count; i++) {
+        real scale = real(random_double(0.5, 1.5));
+        affine_transform place = affine_transform::translation(
+                                     vec3(random_double(-extent, extent), 0, random_double(-extent, extent)))
+                               * affine_transform::rotation(1, random_double(0, 360))
+                               * affine_transform::rotation(0, random_double(-30, 30))
+                               * affine_transform::scaling(vec3(scale, scale, scale));
+        field.add(prototypes[i % 3], place);
+    }
+    field.build();
+
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+    world.add(make_shared<instance_set>(std::move(field)));
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 240;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 10;
+    cam.vfov = 50;
+    cam.lookfrom = point3(0, extent / 8, -extent);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    bench_render(suite, name, cam, virtual_scene(world, materials));
+}
+
+static void print_usage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [--filter text] [--json file] [--baseline file] [--tolerance 0.1] [--threads n]\n"
+                 "  --filter     only run benchmarks whose name contains text\n"
+                 "  --json       write the results as json (what --baseline reads)\n"
+                 "  --baseline   compare throughput with a stored --json file, exit 1 on a regression\n"
+                 "  --tolerance  slowdown that still counts as noise (default 0.1 = 10%%)\n"
+                 "  --threads    render threads for the end to end benchmarks (default 1, 0 = all cores)\n",
+                 program);
+}
+
+int main(int argc, char* argv[]) {
+    bench_options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) options.filter = argv[++i];
+        else if (arg == "--json" && i + 1 < argc) options.json_path = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc) options.baseline_path = argv[++i];
+        else if (arg == "--tolerance" && i + 1 < argc) options.tolerance = std::atof(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc) options.thread_count = std::atoi(argv[++i]);
+        else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    bench_suite suite(options);
+    std::printf("build: %s, %s\n", sizeof(real) == sizeof(float) ? "float" : "double", simd_name());
+
+    std::printf("micro (%d spheres x %d rays for the hit tests)\n",
+                intersection_data::sphere_count, intersection_data::ray_count);
+    bench_intersection(suite);
+    bench_scatter(suite);
+    bench_random_unit_vector(suite);
+
+    std::printf("end to end (%d thread%s)\n", options.thread_count, options.thread_count == 1 ? "" : "s");
+    bench_main_scene(suite);
+    bench_integrators(suite);
+    bench_samplers(suite);
+    bench_sphere_scene(suite, 10, "spheres 10");
+    bench_sphere_scene(suite, 1000, "spheres 1k");
+    bench_sphere_scene(suite, 100000, "spheres 100k");
+    bench_sphere_scene(suite, 100000, "spheres 100k arena", true);
+    bench_mesh_scene(suite, 500, "mesh 500k triangles");
+    bench_instance_scene(suite, 1000000, "instances 1M");
+
+    return suite.finish() ? 0 : 1;
+}
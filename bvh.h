@@ -0,0 +1,390 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// bounding volume hierarchy over a set of boxes
+// instead of testing every object for every ray we test boxes first and only walk into
+// boxes the ray actually goes through, so cost grows with log(n) instead of n
+//
+// the tree is stored as one flat array (depth first order) so the first child of a node is
+// always the next entry and only the second child index is stored, no pointers to chase
+//
+// bvh_tree only knows about boxes, whoever owns it keeps the primitives in leaf order and
+// tests them in the callback given to traverse(). that way the same tree serves bvh_node
+// (virtual hittables) and containers of one concrete type that want inlined hit tests
+class bvh_tree {
+public:
+    // 56 bytes with double (a bit under one cache line), 32 bytes in the float build
+    struct flat_node {
+        real bounds[2][3];  // [0] = min corner, [1] = max corner
+        uint32_t offset;      // leaf: first primitive, inner: index of second child
+        uint16_t prim_count;  // 0 for inner nodes
+        uint8_t axis;         // split axis of inner nodes
+    };
+
+    // builds the tree over boxes, order[i] is the index (into boxes) of the i-th primitive
+    // in leaf order, the owner should reorder its primitives the same way
+    std::vector<uint32_t> build(const std::vector<aabb>& boxes) {
+        nodes.clear();
+        mapped_nodes = nullptr;
+        mapped_count = 0;
+        std::vector<uint32_t> order;
+        if (boxes.empty()) return order;
+
+        std::vector<build_prim> prims(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) {
+            prims[i].box = boxes[i];
+            prims[i].centroid = boxes[i].centroid();
+            prims[i].index = uint32_t(i);
+        }
+
+        nodes.reserve(2 * boxes.size());
+        build_recursive(prims, 0, prims.size(), 0);
+
+        order.reserve(prims.size());
+        for (const auto& p : prims)
+            order.push_back(p.index);
+        return order;
+    }
+
+    // walks every leaf the ray passes through, leaf_hit(i, ray_t) tests primitive i (leaf
+    // order) and returns true on a hit after lowering ray_t.max to the hit distance
+    template <typename LeafHit>
+    bool traverse(const ray& r, interval ray_t, LeafHit&& leaf_hit) const {
+        return walk<false>(r, ray_t, leaf_hit);
+    }
+
+    // same, but stops at the first leaf_hit that returns true. for shadow rays, where any
+    // hit will do and leaf_hit doesn't need to lower ray_t.max
+    template <typename LeafHit>
+    bool traverse_any(const ray& r, interval ray_t, LeafHit&& leaf_hit) const {
+        return walk<true>(r, ray_t, leaf_hit);
+    }
+
+    aabb bounding_box() const {
+        if (node_count() == 0) return aabb::empty;
+        return node_box(node_data()[0]);
+    }
+
+    // new bounds for primitives that moved, boxes in leaf order. the shape of the tree stays
+    // as build() made it and every node just gets the union of its children again, children
+    // come after their parent in the array so one backwards pass does it bottom up.
+    // a small fraction of a build, but the tree gets slower to walk the further things
+    // move away from where they were when it was built
+    void refit(const std::vector<aabb>& boxes) {
+        if (mapped_nodes) {
+            nodes.assign(mapped_nodes, mapped_nodes + mapped_count); // mapped memory is read only
+            mapped_nodes = nullptr;
+            mapped_count = 0;
+        }
+
+        for (size_t i = nodes.size(); i-- > 0;) {
+            flat_node& node = nodes[i];
+            aabb box;
+            if (node.prim_count > 0) {
+                for (uint32_t p = node.offset; p < node.offset + node.prim_count; p++)
+                    box = aabb(box, boxes[p]);
+            } else {
+                box = aabb(node_box(nodes[i + 1]), node_box(nodes[node.offset]));
+            }
+            set_bounds(node, box);
+        }
+    }
+
+    size_t node_count() const { return mapped_nodes ? mapped_count : nodes.size(); }
+
+    // the nodes in depth first order, what a scene cache writes out
+    const flat_node* node_data() const { return mapped_nodes ? mapped_nodes : nodes.data(); }
+
+    // walks nodes that live somewhere else (a memory mapped scene cache) instead of building
+    // its own, the memory has to stay around as long as the tree is used
+    void use_nodes(const flat_node* data, size_t count) {
+        nodes.clear();
+        mapped_nodes = data;
+        mapped_count = count;
+    }
+
+    // whether nodes from somewhere else (a file) are safe to walk over primitive_count
+    // primitives: children come after their parent and inside the array, leaves only name
+    // primitives that exist and no path is deeper than the traversal stack. one pass, a
+    // child's depth is known by the time it's reached since it comes later
+    static bool valid_nodes(const flat_node* data, size_t count, size_t primitive_count) {
+        std::vector<uint8_t> depth(count, 0);
+        for (size_t i = 0; i < count; i++) {
+            const flat_node& node = data[i];
+            if (node.prim_count > 0) {
+                if (node.offset > primitive_count || node.prim_count > primitive_count - node.offset) return false;
+                continue;
+            }
+            if (node.axis > 2 || depth[i] >= max_depth) return false;
+            if (i + 1 >= count || node.offset <= i + 1 || node.offset >= count) return false;
+            uint8_t child_depth = uint8_t(depth[i] + 1);
+            depth[i + 1] = std::max(depth[i + 1], child_depth);
+            depth[node.offset] = std::max(depth[node.offset], child_depth);
+        }
+        return true;
+    }
+
+private:
+    struct build_prim {
+        aabb box;
+        point3 centroid;
+        uint32_t index;
+    };
+
+    static constexpr int bin_count = 16;
+    static constexpr int max_leaf_size = 4;
+    static constexpr int max_depth = 64;
+    static constexpr double traversal_cost = 0.125; // relative to one primitive test
+
+    std::vector<flat_node> nodes;
+    const flat_node* mapped_nodes = nullptr; // set by use_nodes, nodes is empty then
+    size_t mapped_count = 0;
+
+    // the loop of traverse and traverse_any, first_hit_ends is known at compile time so
+    // the closest hit walk doesn't pay for the early out
+    template <bool first_hit_ends, typename LeafHit>
+    bool walk(const ray& r, interval ray_t, LeafHit& leaf_hit) const {
+        if (node_count() == 0) return false;
+        const flat_node* node_array = node_data();
+
+        const point3& orig = r.origin();
+        const vec3& dir = r.direction();
+        const real inv_dir[3] = { 1 / dir.x(), 1 / dir.y(), 1 / dir.z() };
+        const int dir_neg[3] = { inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0 };
+
+        bool any_hit = false;
+
+        uint32_t stack[max_depth + 1];
+        int stack_size = 0;
+        uint32_t current = 0;
+        uint32_t nodes_tested = 0; // for the stats, added once at the end
+
+        while (true) {
+            const flat_node& node = node_array[current];
+            nodes_tested++;
+
+            if (node_hit(node, orig, inv_dir, dir_neg, ray_t)) {
+                if (node.prim_count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.prim_count; i++) {
+                        if (leaf_hit(i, ray_t)) {
+                            any_hit = true;
+                            if (first_hit_ends) break;
+                        }
+                    }
+                    if (stack_size == 0 || (first_hit_ends && any_hit)) break;
+                    current = stack[--stack_size];
+                } else {
+                    // visit the child on the ray's side of the split first, it's more likely
+                    // to give a close hit which then culls the other one
+                    if (dir_neg[node.axis]) {
+                        stack[stack_size++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        stack[stack_size++] = node.offset;
+                        current = current + 1;
+                    }
+                }
+            } else {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+
+        RT_STAT_ADD(bvh_node_tests, nodes_tested);
+        return any_hit;
+    }
+
+    static bool node_hit(const flat_node& node, const point3& orig, const real inv_dir[3],
+                         const int dir_neg[3], const interval& ray_t) {
+        real t_min = ray_t.min, t_max = ray_t.max;
+        for (int axis = 0; axis < 3; axis++) {
+            real t0 = (node.bounds[dir_neg[axis]][axis] - orig[axis]) * inv_dir[axis];
+            real t1 = (node.bounds[1 - dir_neg[axis]][axis] - orig[axis]) * inv_dir[axis];
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        return t_min <= t_max;
+    }
+
+    uint32_t make_leaf(uint32_t node_index, const aabb& box, size_t begin, size_t end) {
+        set_bounds(nodes[node_index], box);
+        nodes[node_index].offset = uint32_t(begin);
+        nodes[node_index].prim_count = uint16_t(end - begin);
+        nodes[node_index].axis = 0;
+        return node_index;
+    }
+
+    static aabb node_box(const flat_node& node) {
+        return aabb(point3(node.bounds[0][0], node.bounds[0][1], node.bounds[0][2]),
+                    point3(node.bounds[1][0], node.bounds[1][1], node.bounds[1][2]));
+    }
+
+    static void set_bounds(flat_node& node, const aabb& box) {
+        for (int axis = 0; axis < 3; axis++) {
+            node.bounds[0][axis] = box.axis_interval(axis).min;
+            node.bounds[1][axis] = box.axis_interval(axis).max;
+        }
+    }
+
+    // binned SAH build: centroids get dropped into bin_count buckets along each axis and
+    // every bucket boundary is tried as a split plane, the cheapest one wins
+    uint32_t build_recursive(std::vector<build_prim>& prims, size_t begin, size_t end, int depth) {
+        uint32_t node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        aabb bounds;
+        real cmin[3] = { infinity, infinity, infinity };
+        real cmax[3] = { -infinity, -infinity, -infinity };
+        for (size_t i = begin; i < end; i++) {
+            bounds = aabb(bounds, prims[i].box);
+            for (int axis = 0; axis < 3; axis++) {
+                cmin[axis] = std::min(cmin[axis], prims[i].centroid[axis]);
+                cmax[axis] = std::max(cmax[axis], prims[i].centroid[axis]);
+            }
+        }
+
+        size_t count = end - begin;
+        if (count <= size_t(max_leaf_size))
+            return make_leaf(node_index, bounds, begin, end);
+
+        int best_axis = -1;
+        int best_split = 0;
+        double best_cost = infinity;
+
+        for (int axis = 0; axis < 3; axis++) {
+            real extent = cmax[axis] - cmin[axis];
+            if (extent <= 0) continue; // all centroids on one plane, nothing to split
+
+            aabb bin_box[bin_count];
+            size_t bin_size[bin_count] = {};
+            real scale = bin_count / extent;
+            for (size_t i = begin; i < end; i++) {
+                int b = std::min(bin_count - 1, int((prims[i].centroid[axis] - cmin[axis]) * scale));
+                bin_box[b] = aabb(bin_box[b], prims[i].box);
+                bin_size[b]++;
+            }
+
+            // sweep from the right once to get area/count of everything right of each plane
+            double right_area[bin_count];
+            size_t right_size[bin_count];
+            aabb acc;
+            size_t acc_size = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                acc = aabb(acc, bin_box[b]);
+                acc_size += bin_size[b];
+                right_area[b] = acc.surface_area();
+                right_size[b] = acc_size;
+            }
+
+            acc = aabb();
+            acc_size = 0;
+            for (int b = 0; b < bin_count - 1; b++) {
+                acc = aabb(acc, bin_box[b]);
+                acc_size += bin_size[b];
+                if (acc_size == 0 || right_size[b + 1] == 0) continue;
+                double cost = acc.surface_area() * acc_size + right_area[b + 1] * right_size[b + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+
+        size_t mid = begin;
+        if (best_axis >= 0 && depth < max_depth - 32) {
+            // cost of the split vs just testing every primitive in a leaf
+            double parent_area = bounds.surface_area();
+            double split_cost = traversal_cost + best_cost / parent_area;
+            if (split_cost >= double(count) && count <= 0xffff)
+                return make_leaf(node_index, bounds, begin, end);
+
+            real scale = bin_count / (cmax[best_axis] - cmin[best_axis]);
+            auto it = std::partition(prims.begin() + begin, prims.begin() + end,
+                [&](const build_prim& p) {
+                    int b = std::min(bin_count - 1, int((p.centroid[best_axis] - cmin[best_axis]) * scale));
+                    return b <= best_split;
+                });
+            mid = size_t(it - prims.begin());
+        }
+
+        // no usable plane (identical centroids, or the tree got too deep), split at the median
+        // of the longest axis so the depth stays bounded
+        if (mid == begin || mid == end) {
+            int axis = bounds.longest_axis();
+            mid = begin + count / 2;
+            std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+                [axis](const build_prim& a, const build_prim& b) {
+                    return a.centroid[axis] < b.centroid[axis];
+                });
+            best_axis = axis;
+        }
+
+        build_recursive(prims, begin, mid, depth + 1);
+        uint32_t second = build_recursive(prims, mid, end, depth + 1);
+
+        set_bounds(nodes[node_index], bounds);
+        nodes[node_index].offset = second;
+        nodes[node_index].prim_count = 0;
+        nodes[node_index].axis = uint8_t(best_axis);
+        return node_index;
+    }
+};
+
+
+// hittable wrapper around bvh_tree for a list of (virtual) objects
+class bvh_node : public hittable {
+public:
+    bvh_node(const hittable_list& list) : bvh_node(list.objects) {}
+
+    bvh_node(const std::vector<shared_ptr<hittable>>& objects) {
+        std::vector<aabb> boxes;
+        boxes.reserve(objects.size());
+        for (const auto& obj : objects)
+            boxes.push_back(obj->bounding_box());
+
+        // primitives get reordered so every leaf points at a contiguous range. the walk
+        // only needs plain pointers, owners keeps the objects alive
+        owners = objects;
+        primitives.reserve(objects.size());
+        for (uint32_t index : tree.build(boxes))
+            primitives.push_back(objects[index].get());
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return tree.traverse(r, ray_t, [&](uint32_t i, interval& t) {
+            if (!primitives[i]->hit(r, t, rec)) return false;
+            t.max = rec.hit_t; // anything further away doesn't matter now
+            return true;
+        });
+    }
+
+    bool hit_any(const ray& r, interval ray_t) const override {
+        return tree.traverse_any(r, ray_t, [&](uint32_t i, interval& t) {
+            return primitives[i]->hit_any(r, t);
+        });
+    }
+
+    // hit() leaves one of the primitives in hit_object, never the node
+    void compute_surface(const ray& r, hit_record& rec) const override {}
+
+    aabb bounding_box() const override { return tree.bounding_box(); }
+
+    size_t node_count() const { return tree.node_count(); }
+
+private:
+    bvh_tree tree;
+    std::vector<const hittable*> primitives;  // leaf order
+    std::vector<shared_ptr<hittable>> owners; // order of the list it was built from
+};
+
+#endif
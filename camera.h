@@ -7,6 +7,90 @@
 #include "color.h"
 #include "ray.h"
 #include "vec3.h"
+#include "thread_pool.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "image_stream.h"
+#include "stats.h"
+#include "distributed.h"
+#include "checkpoint.h"
+#include "wavefront.h"
+#include "light.h"
+#include "denoise.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// how camera follows a path through the scene
+//   recursive - the original ray_color, one call per bounce, always up to max_depth
+//   iterative - a loop with a running throughput that ends low energy paths early with
+//               russian roulette, same expected image but less work per sample
+//   wavefront - the iterative integrator run stage by stage over batches of paths
+//               (wavefront.h), scatter calls grouped by material. same image as iterative
+enum class integrator { recursive, iterative, wavefront };
+
+// a hittable plus its material table behind the virtual interfaces, what
+// render(world, materials) uses. the camera only needs a few calls from a scene (intersect,
+// scatter, for lights emitted, evaluate, has_pdf, occluded and lights, base_color and
+// is_mirror for the denoiser's feature buffers and material_type for the wavefront's binning),
+// so static_scene (static_scene.h) can provide the same ones
+// without virtual calls
+class virtual_scene {
+public:
+    virtual_scene(const hittable& world, const material_table& materials,
+                  const light_list& lights = light_list::none())
+        : world(world), materials(materials), scene_lights(lights) {}
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const {
+        return world.intersect(r, ray_t, rec);
+    }
+
+    bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const {
+        return materials[rec.material_id].scatter(r, rec, attenuation, scattered);
+    }
+
+    color emitted(const ray& r, const hit_record& rec) const {
+        return materials[rec.material_id].emitted(r, rec);
+    }
+
+    color evaluate(const ray& r, const hit_record& rec, const vec3& dir, real& pdf) const {
+        return materials[rec.material_id].evaluate(r, rec, dir, pdf);
+    }
+
+    bool has_pdf(const hit_record& rec) const {
+        return materials.has_pdf(rec.material_id);
+    }
+
+    bool is_mirror(const hit_record& rec) const {
+        return materials.is_mirror(rec.material_id);
+    }
+
+    color base_color(const hit_record& rec) const {
+        return materials[rec.material_id].base_color(rec);
+    }
+
+    // the same for every material of one class, lambertian, metal, ...
+    uint32_t material_type(const hit_record& rec) const {
+        return materials.type(rec.material_id);
+    }
+
+    // anything in the way inside ray_t, for shadow rays
+    bool occluded(const ray& r, interval ray_t) const {
+        return world.hit_any(r, ray_t);
+    }
+
+    const light_list& lights() const { return scene_lights; }
+
+private:
+    const hittable& world;
+    const material_table& materials;
+    const light_list& scene_lights;
+};
 
 class camera {
 public:
@@ -27,24 +111,247 @@ public:
     double defocus_angle = 0; // if we want to simulate depth of field effect
     double focus_dist = 10;   // how far camera is focusing
 
-    void render(const hittable& world) {
+    // 0 means one thread per hardware core, 1 keeps the old single threaded scanline loop
+    int thread_count = 0;
+    int tile_size = 16; // tiles are tile_size x tile_size pixels
+    // render on this pool instead of starting threads for every render, for a process that
+    // renders one image after another (render_server.h). thread_count is ignored then
+    thread_pool* shared_pool = nullptr;
+    // set from another thread to stop a render early: tiles that haven't started yet are
+    // skipped and stay black, and there's no denoising. only the tiled, wavefront and
+    // scanline loops look at it
+    const std::atomic<bool>* cancel = nullptr;
+
+    // more than 1 renders with that many forked worker processes instead of threads
+    // (distributed.h), samples split into sample_passes rounds over the whole image.
+    // no adaptive sampling there, and stats only count what the coordinator does
+    int process_count = 0;
+    int sample_passes = 1;
+    int worker_crash_test = 0; // process_farm::crash_after, for testing tile reassignment
+    int worker_hang_test = 0;  // process_farm::hang_after, the same for a worker that hangs
+    double worker_timeout = 0; // process_farm::task_timeout, 0 follows the slowest tile
+    bool show_progress = true; // scanlines/tiles remaining on std::clog
+
+    // random numbers of every sample come from (pixel, sample index, seed) so the same seed
+    // always gives the same image no matter how many threads render it
+    uint64_t seed = 0;
+    // where the pixel, lens, bounce and light sample positions come from (sampler.h)
+    sampler_kind sampler = sampler_kind::independent;
+
+    // adaptive sampling: every pixel takes at least min_samples, then keeps going (up to
+    // samples_per_pixel) only while its estimated noise is above noise_threshold
+    // the noise is the standard error of the pixel's mean brightness after gamma, so
+    // 0.004 is roughly one step of an 8 bit output
+    bool adaptive_sampling = false;
+    int min_samples = 16;
+    double noise_threshold = 0.004;
+    // if set, render() also writes an image of how many samples every pixel used
+    // (black = min_samples or less, white = samples_per_pixel)
+    std::string spp_debug_path;
+
+    // progressive render into an accumulation buffer file (checkpoint.h): every pass adds
+    // pass_samples to each pixel that still needs them, the file is synced every
+    // checkpoint_interval seconds and a later run with the same camera resumes from it.
+    // samples_per_pixel is the target, with adaptive_sampling a pixel also stops once its
+    // noise is below noise_threshold (min_samples applies), so either can be raised on resume
+    std::string checkpoint_path;
+    int pass_samples = 16;
+    double checkpoint_interval = 60;
+
+    integrator path_integrator = integrator::recursive;
+    // iterative and wavefront integrators: bounces before russian roulette may end a path
+    int roulette_start_depth = 3;
+    // wavefront: paths traced together, a tile's samples are split into batches about
+    // this big. larger batches bin better but stop fitting in the cache
+    int wavefront_batch_size = 4096;
+
+    // next event estimation: diffuse hits send a shadow ray to one of the scene's lights
+    // (light.h) and combine it with what scattering finds by multiple importance sampling.
+    // scenes without lights render the same with it on or off
+    bool light_sampling = true;
+    // scale of the sky gradient, 0 for scenes lit only by their lights
+    double sky_brightness = 1;
+
+    // edge aware denoising after the render (denoise.h), guided by first hit albedo and
+    // normal buffers the integrators note while rendering (note_hit / note_miss), only
+    // checkpointed and worker process renders trace the camera rays again for them
+    // (render_features). meant for low sample counts, 8 to 16 per pixel instead of 100 or more
+    bool denoise = false;
+    denoise_settings denoise_options;
+    // if set, render() also writes the albedo and normal buffers (normals as 0.5 + 0.5 n)
+    std::string albedo_path, normal_path;
+
+    // where render() writes the finished image, empty or "-" means stdout
+    std::string output_path;
+    image_format output_format = image_format::ppm;
+    // render() writes the image while rendering it (image_stream.h): tiles are handed out a
+    // row of tiles after the other and every finished row of tiles goes to the output on a
+    // writer thread, only stream_window of them (0 = enough to keep every thread busy) are
+    // in memory at once. anything that needs the whole image (denoising, the feature and
+    // sample count images, checkpoints, worker processes) renders it first as before
+    bool stream_output = false;
+    int stream_window = 0;
+    // render_image() keeps the framebuffer in a scratch file in this directory instead of
+    // in memory (framebuffer.h), a checkpoint render resolves its file into it. the render
+    // fails if the file can't be made, or with denoising, feature or sample count images or
+    // worker processes, which all keep whole images in memory besides it
+    std::string framebuffer_directory;
+
+    // materials is the table the objects' material ids point into, lights the emissive
+    // spheres among the objects (find_lights). false if the render couldn't run (see
+    // last_render_failed) or an image couldn't be written
+    bool render(const hittable& world, const material_table& materials,
+                const light_list& lights = light_list::none()) {
+        return render(virtual_scene(world, materials, lights));
+    }
+
+    // any scene type with the calls of virtual_scene
+    template <class Scene>
+    bool render(const Scene& world) {
+        if (stream_output) {
+            if (can_stream()) return render_streaming(world);
+            std::clog << "streaming is off with denoising, feature or sample count images, "
+                         "checkpoints and worker processes\n";
+        }
+
+        framebuffer image = render_image(world);
+        if (render_failed) return false;
+        bool ok = write_image(image, output_path, output_format);
+
+        if (!spp_debug_path.empty())
+            ok = write_image(sample_count_image(), spp_debug_path,
+                             image_format_from_path(spp_debug_path, image_format::ppm)) && ok;
+        if (!albedo_path.empty())
+            ok = write_image(features.albedo, albedo_path, image_format_from_path(albedo_path, image_format::ppm)) && ok;
+        if (!normal_path.empty())
+            ok = write_image(normal_image(), normal_path, image_format_from_path(normal_path, image_format::ppm)) && ok;
+        return ok;
+    }
+
+    // renders into a linear float framebuffer without writing anything
+    framebuffer render_image(const hittable& world, const material_table& materials,
+                             const light_list& lights = light_list::none()) {
+        return render_image(virtual_scene(world, materials, lights));
+    }
+
+    template <class Scene>
+    framebuffer render_image(const Scene& world) {
         initialize(); // sets up camera properties
+        render_failed = false;
+
+        // a framebuffer_directory is there because the image doesn't fit in memory, so no
+        // scratch file (or something that needs more whole images) means no render rather
+        // than trying it in memory anyway
+        framebuffer image;
+        bool wants_features = denoise || !albedo_path.empty() || !normal_path.empty();
+        if (!framebuffer_directory.empty() && (wants_features || !spp_debug_path.empty() || process_count > 1)) {
+            std::cerr << "denoising, feature and sample count images and worker processes keep whole "
+                         "images in memory, they don't go with a framebuffer directory\n";
+            return failed_render();
+        }
+        if (framebuffer_directory.empty())
+            image = framebuffer(image_width, image_height);
+        else if (!image.map_file(framebuffer_directory, image_width, image_height))
+            return failed_render();
+
+        // the integrators note the first hits of the samples for the feature buffers as they
+        // go. checkpointed and worker process renders take their samples in another run or
+        // process, their features are traced again after the render (render_features)
+        bool features_after = !checkpoint_path.empty() || process_count > 1;
+        features = feature_buffers();
+        if (wants_features && !features_after) {
+            features.albedo = framebuffer(image_width, image_height);
+            features.normal = framebuffer(image_width, image_height);
+            features.variance.assign(size_t(image_width) * image_height, 0.0f);
+        }
+
+        // 4 more bytes a pixel, only kept when something looks at them
+        bool keep_counts = adaptive_sampling || !spp_debug_path.empty() || process_count > 1;
+        pixel_sample_counts.assign(keep_counts ? size_t(image_width) * image_height : 0, 0);
+
+        // with RT_STATS the counters describe this render only
+        if (stats_enabled) stats_registry::instance().reset();
+        auto start = std::chrono::steady_clock::now();
+
+        bool rendered = true;
+        if (!checkpoint_path.empty())
+            rendered = render_progressive(world, image);
+        else if (process_count > 1)
+            render_processes(world, image);
+        else if (path_integrator == integrator::wavefront)
+            render_wavefront(world, image);
+        else if (thread_count == 1 && !shared_pool)
+            render_serial(world, image);
+        else
+            render_tiles(world, image);
+        if (!rendered) return failed_render();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        render_seconds = elapsed.count();
+
+        if (adaptive_sampling) {
+            double total = 0;
+            for (int n : pixel_sample_counts) total += n;
+            std::clog << "Average samples per pixel: " << total / pixel_sample_counts.size()
+                      << " of " << samples_per_pixel << '\n';
+        }
+
+        denoise_seconds = 0;
+        if (wants_features && !cancelled()) {
+            start = std::chrono::steady_clock::now();
+            if (features_after) render_features(world);
+            // a single sample says nothing about its noise, the denoiser guesses it then
+            if (samples_per_pixel < 2) features.variance.clear();
+            if (denoise) {
+                atrous_denoiser denoiser;
+                denoiser.settings = denoise_options;
+                denoiser.thread_count = thread_count;
+                denoiser.shared_pool = shared_pool;
+                image = denoiser.denoise(image, features);
+            }
+            std::chrono::duration<double> denoise_elapsed = std::chrono::steady_clock::now() - start;
+            denoise_seconds = denoise_elapsed.count();
+            if (denoise && show_progress)
+                std::clog << "Denoised in " << denoise_seconds << " s\n";
+        }
+
+        return image;
+    }
+
+    // the last render_image() call couldn't render what was asked for (a checkpoint of
+    // another render, ...) and returned an empty image, the reason went to std::cerr
+    bool last_render_failed() const { return render_failed; }
+
+    // albedo and normal buffers of the last render_image() call, empty unless it denoised
+    // or wrote them
+    const feature_buffers& feature_images() const { return features; }
 
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    // wall time of the denoiser in the last render_image() call, with the feature pass of a
+    // checkpointed or worker process render
+    double last_denoise_seconds() const { return denoise_seconds; }
 
-        // going row by row and then col by col and averaging color samples to make image smooth
+    // samples every pixel took in the last render_image() call, row major. empty unless
+    // adaptive sampling, spp_debug_path or worker processes needed them
+    const std::vector<int>& sample_counts() const { return pixel_sample_counts; }
+
+    // wall time of the last render_image() call, without writing the image
+    double last_render_seconds() const { return render_seconds; }
+
+    // sample counts of the last render as a grey ramp, min_samples is black and
+    // samples_per_pixel white
+    framebuffer sample_count_image() const {
+        framebuffer heatmap(image_width, image_height);
+        int low = adaptive_sampling ? std::min(min_samples, samples_per_pixel) : 0;
+        double range = std::max(1, samples_per_pixel - low);
         for (int y = 0; y < image_height; y++) {
-            std::clog << "\rScanlines remaining: " << (image_height - y) << ' ' << std::flush;
             for (int x = 0; x < image_width; x++) {
-                color pixel_sum(0, 0, 0);
-                for (int s = 0; s < samples_per_pixel; s++) {
-                    ray r = get_ray(x, y);
-                    pixel_sum += ray_color(r, max_depth, world);
-                }
-                write_color(std::cout, pixel_samples_scale * pixel_sum);
+                double level = (pixel_sample_counts[size_t(y) * image_width + x] - low) / range;
+                level = level < 0 ? 0 : level;
+                // squared so the gamma 2 of the writers turns it back into a linear ramp
+                heatmap.set(x, y, color(level * level, level * level, level * level));
             }
         }
-        std::clog << "\rDone.                 \n";
+        return heatmap;
     }
 
 private:
@@ -55,6 +362,16 @@ private:
     vec3 pixel_delta_u, pixel_delta_v;
     vec3 u, v, w; // camera coordinate system basis
     vec3 defocus_disk_u, defocus_disk_v; // vectors for defocus effect
+    std::vector<int> pixel_sample_counts;
+    double render_seconds = 0;
+    feature_buffers features;
+    double denoise_seconds = 0;
+    bool render_failed = false;
+
+    framebuffer failed_render() {
+        render_failed = true;
+        return framebuffer();
+    }
 
     void initialize() {
         image_height = int(image_width / aspect_ratio);
@@ -91,7 +408,646 @@ private:
         defocus_disk_v = v * defocus_radius;
     }
 
+    // averaging color samples of one pixel to make image smooth. first_hits (if given) gets
+    // the features of the samples added up
+    template <class Scene>
+    color render_pixel(int x, int y, const Scene& world, int& samples_used, feature_sum* first_hits = nullptr) const {
+        if (adaptive_sampling)
+            return render_pixel_adaptive(x, y, world, samples_used, first_hits);
+
+        color pixel_sum = sample_sum(x, y, 0, samples_per_pixel, world, first_hits);
+        samples_used = samples_per_pixel;
+        return pixel_samples_scale * pixel_sum;
+    }
+
+    // sum (not mean) of samples first_sample .. first_sample + count - 1 of a pixel, any
+    // split of the sample indices adds up to the same samples
+    template <class Scene>
+    color sample_sum(int x, int y, int first_sample, int count, const Scene& world,
+                     feature_sum* first_hits = nullptr) const {
+        color sum(0, 0, 0);
+        for (int s = first_sample; s < first_sample + count; s++) {
+            start_sample(x, y, s);
+            ray r = get_ray(x, y);
+            feature_sample first_hit;
+            color sample = sample_color(r, world, first_hits ? &first_hit : nullptr);
+            sum += sample;
+            if (first_hits) first_hits->add(first_hit, sample);
+        }
+        return sum;
+    }
+
+    // same as render_pixel but stops once the pixel has converged
+    // running mean/variance of the sample brightness is kept with Welford's method, the
+    // check only happens every few samples so one lucky streak can't end a pixel early
+    template <class Scene>
+    color render_pixel_adaptive(int x, int y, const Scene& world, int& samples_used,
+                                feature_sum* first_hits = nullptr) const {
+        const int check_interval = 8;
+        int first_check = std::max(2, std::min(min_samples, samples_per_pixel));
+
+        color pixel_sum(0, 0, 0);
+        double mean = 0, m2 = 0;
+        int n = 0;
+
+        while (n < samples_per_pixel) {
+            start_sample(x, y, n);
+            ray r = get_ray(x, y);
+            feature_sample first_hit;
+            color sample = sample_color(r, world, first_hits ? &first_hit : nullptr);
+            if (first_hits) first_hits->add(first_hit, sample);
+            pixel_sum += sample;
+            n++;
+
+            double luminance = 0.2126 * sample.x() + 0.7152 * sample.y() + 0.0722 * sample.z();
+            double delta = luminance - mean;
+            mean += delta / n;
+            m2 += delta * (luminance - mean);
+
+            if (n >= first_check && (n - first_check) % check_interval == 0) {
+                // standard error of the mean, then pushed through the sqrt gamma curve:
+                // d(sqrt(L)) = dL / (2 sqrt(L))
+                double std_error = std::sqrt(m2 / (n - 1) / n);
+                double display_error = std_error / (2 * std::sqrt(std::max(mean, 1e-4)));
+                if (display_error <= noise_threshold) break;
+            }
+        }
+
+        samples_used = n;
+        return pixel_sum / n;
+    }
+
+    template <class Scene>
+    void shade_pixel(int x, int y, const Scene& world, framebuffer& image) {
+        int samples_used = 0;
+        feature_sum first_hits;
+        bool noting = noting_features();
+        image.set(x, y, render_pixel(x, y, world, samples_used, noting ? &first_hits : nullptr));
+        if (noting) set_features(x, y, first_hits, samples_used);
+        if (!pixel_sample_counts.empty()) pixel_sample_counts[size_t(y) * image_width + x] = samples_used;
+    }
+
+    // whether this render_image() call fills the feature buffers while it renders
+    bool noting_features() const { return features.albedo.width() > 0; }
+
+    void set_features(int x, int y, const feature_sum& first_hits, int samples) {
+        features.albedo.set(x, y, first_hits.albedo / samples);
+        features.normal.set(x, y, first_hits.normal / samples);
+        features.variance[size_t(y) * image_width + x] = first_hits.variance(samples);
+    }
+
+    template <class Scene>
+    void render_serial(const Scene& world, framebuffer& image) {
+        // going row by row and then col by col
+        for (int y = 0; y < image_height && !cancelled(); y++) {
+            RT_STAT_TILE_TIMER(); // a scanline counts as a tile here
+            if (show_progress)
+                std::clog << "\rScanlines remaining: " << (image_height - y) << ' ' << std::flush;
+            for (int x = 0; x < image_width; x++)
+                shade_pixel(x, y, world, image);
+            image.release_rows(y, y + 1); // out of core framebuffers only
+        }
+        if (show_progress) std::clog << "\rDone.                 \n";
+    }
+
+    bool cancelled() const {
+        return cancel && cancel->load(std::memory_order_relaxed);
+    }
+
+    // the pool a render runs on: shared_pool if there is one, else own gets a new one
+    thread_pool& render_pool(std::unique_ptr<thread_pool>& own) {
+        if (shared_pool) return *shared_pool;
+        own = std::make_unique<thread_pool>(thread_count);
+        return *own;
+    }
+
+    // tiles left in every row of tiles of an out of core framebuffer (empty for one in
+    // memory), tile_finished gives a row of tiles' memory back when its last tile is done
+    static std::unique_ptr<std::atomic<int>[]> out_of_core_bands(const framebuffer& image, int tiles_x, int tiles_y) {
+        if (!image.is_mapped()) return nullptr;
+        auto counts = std::make_unique<std::atomic<int>[]>(size_t(tiles_y));
+        for (int i = 0; i < tiles_y; i++) counts[i] = tiles_x;
+        return counts;
+    }
+
+    static void tile_finished(const framebuffer& image, std::unique_ptr<std::atomic<int>[]>& band_tiles_left,
+                              int band, int y0, int y1) {
+        if (band_tiles_left && --band_tiles_left[band] == 0) image.release_rows(y0, y1);
+    }
+
+    // splits the image into tiles and lets the pool hand them out, every tile writes
+    // only its own pixels so no locking is needed on the image itself
+    template <class Scene>
+    void render_tiles(const Scene& world, framebuffer& image) {
+        int tile = tile_size > 0 ? tile_size : 16;
+        int tiles_x = (image_width + tile - 1) / tile;
+        int tiles_y = (image_height + tile - 1) / tile;
+        int tile_count = tiles_x * tiles_y;
+
+        std::unique_ptr<thread_pool> own_pool;
+        thread_pool& pool = render_pool(own_pool);
+
+        std::mutex progress_mutex;
+        int tiles_remaining = tile_count;
+        auto band_tiles_left = out_of_core_bands(image, tiles_x, tiles_y);
+
+        pool.parallel_for(tile_count, [&](int tile_index) {
+            if (cancelled()) return;
+            int x0 = (tile_index % tiles_x) * tile;
+            int y0 = (tile_index / tiles_x) * tile;
+            int x1 = std::min(x0 + tile, image_width);
+            int y1 = std::min(y0 + tile, image_height);
+
+            {
+                RT_STAT_TILE_TIMER();
+                for (int y = y0; y < y1; y++)
+                    for (int x = x0; x < x1; x++)
+                        shade_pixel(x, y, world, image);
+            }
+            tile_finished(image, band_tiles_left, tile_index / tiles_x, y0, y1);
+
+            if (!show_progress) return;
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            tiles_remaining--;
+            std::clog << "\rTiles remaining: " << tiles_remaining << ' ' << std::flush;
+        });
+        if (show_progress) std::clog << "\rDone.                 \n";
+    }
+
+    // render() can write the image while rendering it, nothing needs the whole image after
+    bool can_stream() const {
+        return !denoise && albedo_path.empty() && normal_path.empty() && spp_debug_path.empty()
+            && checkpoint_path.empty() && process_count <= 1;
+    }
+
+    // tiles in file order through an ordered_band_writer: every thread takes the next tile
+    // of a shared counter, so the tiles in flight are the oldest ones and the bands
+    // complete about in order. a thread only waits when the band of its next tile is the
+    // window ahead of the writer, the tiles of the bands before are all taken by then and
+    // their threads are still running, so the writer always gets its band
+    template <class Scene>
+    bool render_streaming(const Scene& world) {
+        initialize();
+        pixel_sample_counts.clear();
+        features = feature_buffers();
+        denoise_seconds = 0;
+
+        std::ofstream file;
+        render_failed = false;
+        std::ostream* out = open_image_output(output_path, file);
+        if (!out) return false;
+
+        if (stats_enabled) stats_registry::instance().reset();
+        auto start = std::chrono::steady_clock::now();
+
+        int tile = tile_size > 0 ? tile_size : 16;
+        int tiles_x = (image_width + tile - 1) / tile;
+
+        std::unique_ptr<thread_pool> own_pool;
+        thread_pool& pool = render_pool(own_pool);
+        // two tiles in flight for every thread, plus the band being written
+        int window = stream_window > 0 ? stream_window : (2 * pool.size() + tiles_x - 1) / tiles_x + 1;
+
+        ordered_band_writer stream(*out, output_format, image_width, image_height, tile, tiles_x, window);
+        int tile_count = tiles_x * stream.band_count();
+        if (path_integrator == integrator::wavefront && adaptive_sampling)
+            std::clog << "adaptive sampling is off with the wavefront integrator, every pixel gets "
+                      << samples_per_pixel << " samples\n";
+
+        std::atomic<int> next_tile(0);
+        std::atomic<long long> samples_taken(0);
+        std::mutex progress_mutex;
+        int tiles_remaining = tile_count;
+
+        pool.parallel_for(pool.size(), [&](int) {
+            for (int t = next_tile++; t < tile_count; t = next_tile++) {
+                int band = t / tiles_x;
+                framebuffer& rows = stream.begin_band(band);
+                if (!cancelled()) {
+                    int x0 = (t % tiles_x) * tile;
+                    int y0 = stream.band_rows_from(band);
+                    int x1 = std::min(x0 + tile, image_width);
+                    int y1 = std::min(y0 + tile, image_height);
+
+                    RT_STAT_TILE_TIMER();
+                    long long samples = 0;
+                    if (path_integrator == integrator::wavefront) {
+                        trace_wavefront(world, x0, y0, x1, y1, rows, y0);
+                        samples = (long long)(x1 - x0) * (y1 - y0) * samples_per_pixel;
+                    } else {
+                        for (int y = y0; y < y1; y++) {
+                            for (int x = x0; x < x1; x++) {
+                                int samples_used = 0;
+                                rows.set(x, y - y0, render_pixel(x, y, world, samples_used));
+                                samples += samples_used;
+                            }
+                        }
+                    }
+                    samples_taken += samples;
+                }
+                stream.tile_done(band);
+
+                if (!show_progress) continue;
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                tiles_remaining--;
+                std::clog << "\rTiles remaining: " << tiles_remaining << ' ' << std::flush;
+            }
+        });
+        bool written = stream.finish();
+        if (!written)
+            std::cerr << "could not write " << (out == &std::cout ? "to stdout" : output_path) << "\n";
+        if (show_progress) std::clog << "\rDone.                 \n";
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        render_seconds = elapsed.count();
+
+        if (adaptive_sampling)
+            std::clog << "Average samples per pixel: " << double(samples_taken) / (double(image_width) * image_height)
+                      << " of " << samples_per_pixel << '\n';
+        return written;
+    }
+
+    // what has to match for samples of two runs to belong to the same image (checkpoint.h),
+    // the sample targets are left out since raising them is the point of resuming. except
+    // for the stratified and blue noise samplers, whose pattern is laid out for that many
+    // samples: a raised --spp would put new samples where the old ones already are
+    uint64_t settings_hash() const {
+        uint64_t hash = hash_bytes(&max_depth, sizeof(max_depth));
+        auto add = [&](const auto& value) { hash = hash_bytes(&value, sizeof(value), hash); };
+        add(vfov);
+        add(lookfrom);
+        add(lookat);
+        add(vup);
+        add(defocus_angle);
+        add(focus_dist);
+        add(path_integrator);
+        add(roulette_start_depth);
+        add(light_sampling);
+        add(sky_brightness);
+        add(sampler);
+        if (sampler == sampler_kind::stratified || sampler == sampler_kind::blue_noise) add(samples_per_pixel);
+        return hash;
+    }
+
+    // adds count samples (indices continue from what the pixel has) to an accumulated pixel
+    template <class Scene>
+    void add_samples(int x, int y, int count, const Scene& world, accum_pixel& pixel) const {
+        // worked on a copy that's stored back in one go, so a kill leaves a pixel's sums and
+        // sample count at most a few stores apart instead of a whole pass
+        accum_pixel updated = pixel;
+        for (int i = 0; i < count; i++) {
+            start_sample(x, y, int(updated.samples));
+            ray r = get_ray(x, y);
+            color sample = sample_color(r, world);
+            double luminance = 0.2126 * sample.x() + 0.7152 * sample.y() + 0.0722 * sample.z();
+            updated.sum[0] += sample.x();
+            updated.sum[1] += sample.y();
+            updated.sum[2] += sample.z();
+            updated.luminance_sum += luminance;
+            updated.luminance_squared_sum += luminance * luminance;
+            updated.samples++;
+        }
+        pixel = updated;
+    }
+
+    bool needs_samples(const accum_pixel& pixel) const {
+        if (int(pixel.samples) >= samples_per_pixel) return false;
+        if (adaptive_sampling && int(pixel.samples) >= min_samples)
+            return pixel.display_error() > noise_threshold;
+        return true;
+    }
+
+    // passes over the whole image into a memory mapped accumulation buffer until every pixel
+    // has its samples, resuming from whatever the file already holds. false if the file
+    // can't be used (another render's checkpoint, no space): the render was asked to be
+    // resumable, so it doesn't go on for hours without one
+    template <class Scene>
+    bool render_progressive(const Scene& world, framebuffer& image) {
+        accumulation_buffer accum;
+        if (!accum.open(checkpoint_path, image_width, image_height, seed, settings_hash())) {
+            std::cerr << "not rendering without the checkpoint " << checkpoint_path << "\n";
+            return false;
+        }
+
+        uint64_t resumed = accum.total_samples();
+        if (resumed > 0 && show_progress)
+            std::clog << "Resuming " << checkpoint_path << " at " << double(resumed) / (double(image_width) * image_height)
+                      << " samples per pixel\n";
+
+        int tile = tile_size > 0 ? tile_size : 16;
+        int tiles_x = (image_width + tile - 1) / tile;
+        int tiles_y = (image_height + tile - 1) / tile;
+        int step = std::max(1, pass_samples);
+
+        std::unique_ptr<thread_pool> own_pool;
+        thread_pool& pool = render_pool(own_pool);
+        auto last_checkpoint = std::chrono::steady_clock::now();
+
+        for (int pass = 1;; pass++) {
+            std::atomic<int> sampled(0);
+            // an out of core render gives the buffer's rows back like the image's, every pass
+            // goes over the whole file and would bring all of it into memory otherwise
+            auto band_tiles_left = out_of_core_bands(image, tiles_x, tiles_y);
+            pool.parallel_for(tiles_x * tiles_y, [&](int tile_index) {
+                RT_STAT_TILE_TIMER();
+                int x0 = (tile_index % tiles_x) * tile;
+                int y0 = (tile_index / tiles_x) * tile;
+                int count = 0;
+                for (int y = y0; y < std::min(y0 + tile, image_height); y++) {
+                    for (int x = x0; x < std::min(x0 + tile, image_width); x++) {
+                        accum_pixel& pixel = accum.at(x, y);
+                        if (!needs_samples(pixel)) continue;
+                        add_samples(x, y, std::min(step, samples_per_pixel - int(pixel.samples)), world, pixel);
+                        count++;
+                    }
+                }
+                sampled += count;
+                if (band_tiles_left && --band_tiles_left[tile_index / tiles_x] == 0)
+                    accum.release_rows(y0, std::min(y0 + tile, image_height));
+            });
+            if (sampled == 0) break;
+
+            if (show_progress)
+                std::clog << "\rPass " << pass << ": " << sampled << " pixels sampled      " << std::flush;
+
+            std::chrono::duration<double> since = std::chrono::steady_clock::now() - last_checkpoint;
+            if (since.count() >= checkpoint_interval) {
+                accum.checkpoint();
+                last_checkpoint = std::chrono::steady_clock::now();
+            }
+        }
+        accum.checkpoint();
+        if (show_progress) std::clog << "\rDone.                              \n";
+
+        if (!pixel_sample_counts.empty()) {
+            for (int y = 0; y < image_height; y++) {
+                for (int x = 0; x < image_width; x++)
+                    pixel_sample_counts[size_t(y) * image_width + x] = int(accum.at(x, y).samples);
+                accum.release_rows(y, y + 1);
+            }
+        }
+        accum.resolve(image);
+        return true;
+    }
+
+    // forks process_count workers that each get a copy of the camera and the scene
+    template <class Scene>
+    void render_processes(const Scene& world, framebuffer& image) {
+        if (adaptive_sampling)
+            std::clog << "adaptive sampling is off with worker processes, every pixel gets "
+                      << samples_per_pixel << " samples\n";
+
+        process_farm farm;
+        farm.worker_count = process_count;
+        farm.tile_size = tile_size;
+        farm.passes = sample_passes;
+        farm.show_progress = show_progress;
+        farm.crash_after = worker_crash_test;
+        farm.hang_after = worker_hang_test;
+        farm.task_timeout = worker_timeout;
+        farm.render(image_width, image_height, samples_per_pixel,
+                    [&](int x, int y, int first, int count) { return sample_sum(x, y, first, count, world); },
+                    image, pixel_sample_counts);
+    }
+
+    // tiles as in render_tiles, but each tile is traced by trace_wavefront
+    template <class Scene>
+    void render_wavefront(const Scene& world, framebuffer& image) {
+        if (adaptive_sampling)
+            std::clog << "adaptive sampling is off with the wavefront integrator, every pixel gets "
+                      << samples_per_pixel << " samples\n";
+
+        int tile = tile_size > 0 ? tile_size : 16;
+        int tiles_x = (image_width + tile - 1) / tile;
+        int tiles_y = (image_height + tile - 1) / tile;
+        int tile_count = tiles_x * tiles_y;
+
+        std::unique_ptr<thread_pool> own_pool;
+        thread_pool& pool = render_pool(own_pool);
+        std::mutex progress_mutex;
+        int tiles_remaining = tile_count;
+        auto band_tiles_left = out_of_core_bands(image, tiles_x, tiles_y);
+
+        pool.parallel_for(tile_count, [&](int tile_index) {
+            if (cancelled()) return;
+            int x0 = (tile_index % tiles_x) * tile;
+            int y0 = (tile_index / tiles_x) * tile;
+            int y1 = std::min(y0 + tile, image_height);
+            {
+                RT_STAT_TILE_TIMER();
+                trace_wavefront(world, x0, y0, std::min(x0 + tile, image_width), y1, image);
+            }
+            tile_finished(image, band_tiles_left, tile_index / tiles_x, y0, y1);
+
+            if (!show_progress) return;
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            tiles_remaining--;
+            std::clog << "\rTiles remaining: " << tiles_remaining << ' ' << std::flush;
+        });
+        if (show_progress) std::clog << "\rDone.                 \n";
+    }
+
+    // every sample of the pixels in [x0, x1) x [y0, y1), in batches of whole sample indices.
+    // a path draws its random numbers in the same order as in trace_path and a pixel's
+    // samples are added up in sample order, so the image matches the iterative integrator.
+    // only one batch's paths have a result slot, they're added to the pixel sums when the
+    // batch is done, so memory doesn't grow with the sample count.
+    // pixel x, y goes to x, y - image_y0 of image (a band of the image when streaming)
+    template <class Scene>
+    void trace_wavefront(const Scene& world, int x0, int y0, int x1, int y1, framebuffer& image, int image_y0 = 0) {
+        thread_local wavefront_batch batch;
+        int width = x1 - x0;
+        int pixel_count = width * (y1 - y0);
+        int spp = samples_per_pixel;
+        int samples_per_batch = std::max(1, std::min(spp, wavefront_batch_size / std::max(1, pixel_count)));
+
+        batch.pixel_sums.assign(size_t(pixel_count), color(0, 0, 0));
+        bool noting = noting_features();
+        batch.pixel_features.assign(noting ? size_t(pixel_count) : 0, feature_sum());
+
+        for (int first = 0; first < spp; first += samples_per_batch) {
+            int last = std::min(spp, first + samples_per_batch);
+            int batch_samples = last - first;
+            batch.results.assign(size_t(pixel_count) * batch_samples, color(0, 0, 0));
+            batch.features.assign(noting ? size_t(pixel_count) * batch_samples : 0, feature_sample());
+
+            // generate
+            path_queue& paths = batch.current;
+            paths.clear();
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    uint32_t pixel = uint32_t((y - y0) * width + (x - x0));
+                    for (int s = first; s < last; s++) {
+                        start_sample(x, y, s);
+                        ray r = get_ray(x, y);
+                        paths.push(r, color(1, 1, 1), path_vertex(), pixel * batch_samples + (s - first),
+                                   thread_rng(), thread_sampler());
+                    }
+                }
+            }
+
+            for (int depth = 0; depth < max_depth && batch.current.size() > 0; depth++)
+                wavefront_bounce(world, depth, batch);
+            // paths still going after max_depth bounces keep what they gathered so far
+            for (size_t i = 0; i < batch.current.size(); i++) RT_STAT_PATH_END(max_depth, max_depth);
+
+            // in sample order, the same additions sample_sum makes
+            for (size_t pixel = 0; pixel < size_t(pixel_count); pixel++)
+                for (int s = 0; s < batch_samples; s++)
+                    batch.pixel_sums[pixel] += batch.results[pixel * batch_samples + s];
+            for (size_t pixel = 0; pixel < batch.pixel_features.size(); pixel++)
+                for (int s = 0; s < batch_samples; s++)
+                    batch.pixel_features[pixel].add(batch.features[pixel * batch_samples + s],
+                                                    batch.results[pixel * batch_samples + s]);
+        }
+
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                size_t pixel = size_t((y - y0) * width + (x - x0));
+                image.set(x, y - image_y0, pixel_samples_scale * batch.pixel_sums[pixel]);
+                if (noting) set_features(x, y, batch.pixel_features[pixel], spp);
+                if (!pixel_sample_counts.empty()) pixel_sample_counts[size_t(y) * image_width + x] = spp;
+            }
+        }
+    }
+
+    // one bounce of every live path: intersect, bin the hits by material type and material,
+    // scatter in that order and compact the survivors into batch.next, which becomes
+    // batch.current
+    template <class Scene>
+    void wavefront_bounce(const Scene& world, int depth, wavefront_batch& batch) const {
+        path_queue& paths = batch.current;
+        size_t count = paths.size();
+
+        // intersect. hits only grows, constructing records that get overwritten anyway costs
+        if (batch.hits.size() < count) batch.hits.resize(count);
+        batch.hit_paths.clear();
+        batch.keys.clear();
+        batch.types.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (depth > 0) RT_STAT_INC(secondary_rays);
+            ray r = paths.path_ray(i);
+            if (world.intersect(r, interval(0, infinity), batch.hits[i])) {
+                batch.hit_paths.push_back(uint32_t(i));
+                batch.keys.push_back(batch.hits[i].material_id);
+                batch.types.push_back(world.material_type(batch.hits[i]));
+            } else {
+                RT_STAT_PATH_END(missed, depth);
+                batch.results[paths.path_id[i]] += paths.weight(i) * background(r);
+                if (!batch.features.empty()) note_miss(&batch.features[paths.path_id[i]]);
+            }
+        }
+
+        // bin by material type, then material
+        sort_by_type_and_key(batch.types, batch.keys, batch.order, batch.by_key, batch.key_counts);
+
+        // scatter (with the light sampling of the hit) and compact
+        bool sample_lights = samples_lights(world);
+        path_queue& survivors = batch.next;
+        survivors.clear();
+        for (uint32_t k : batch.order) {
+            uint32_t i = batch.hit_paths[k];
+            thread_rng() = paths.rng[i];
+            thread_sampler() = paths.sampler[i];
+
+            ray r = paths.path_ray(i);
+            const hit_record& rec = batch.hits[i];
+            color weight = paths.weight(i);
+            color& result = batch.results[paths.path_id[i]];
+            if (!batch.features.empty()) note_hit(world, rec, &batch.features[paths.path_id[i]]);
+            result += weight * hit_emission(world, r, rec, paths.vertex(i));
+
+            ray scattered;
+            color attenuation;
+            if (!world.scatter(r, rec, attenuation, scattered)) {
+                RT_STAT_PATH_END(absorbed, depth);
+                continue;
+            }
+
+            path_vertex from;
+            if (sample_lights) {
+                result += weight * direct_light(world, r, rec);
+                from = scatter_vertex(world, r, rec, scattered);
+            }
+
+            color throughput = weight * attenuation;
+            if (depth + 1 >= roulette_start_depth) {
+                double p = std::fmin(0.95, std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())));
+                if (random_double() >= p) {
+                    RT_STAT_PATH_END(roulette, depth + 1);
+                    continue;
+                }
+                throughput /= p;
+            }
+            survivors.push(scattered, throughput, from, paths.path_id[i], thread_rng(), thread_sampler());
+        }
+        std::swap(batch.current, batch.next);
+    }
+
+    // fills features for a render whose samples were taken elsewhere (a checkpoint's other
+    // runs, worker processes): traces the camera rays of up to max_feature_samples samples
+    // per pixel again, the same rays (same seeds) the render shot, and follows them through
+    // mirrors the way the integrators do (note_hit). a few intersections per sample and no
+    // shading
+    template <class Scene>
+    void render_features(const Scene& world) {
+        const int max_feature_samples = 16;
+        int samples = std::max(1, std::min(samples_per_pixel, max_feature_samples));
+        features.albedo = framebuffer(image_width, image_height);
+        features.normal = framebuffer(image_width, image_height);
+
+        std::unique_ptr<thread_pool> own_pool;
+        thread_pool& pool = render_pool(own_pool);
+        pool.parallel_for(image_height, [&](int y) {
+            for (int x = 0; x < image_width; x++) {
+                color albedo_sum(0, 0, 0);
+                vec3 normal_sum(0, 0, 0);
+                for (int s = 0; s < samples; s++) {
+                    start_sample(x, y, s);
+                    ray r = camera_ray(x, y);
+                    feature_sample first_hit;
+                    for (int depth = 0; depth < max_depth && !first_hit.done; depth++) {
+                        hit_record rec;
+                        if (!world.intersect(r, interval(0, infinity), rec)) {
+                            note_miss(&first_hit);
+                            break;
+                        }
+                        note_hit(world, rec, &first_hit);
+                        color attenuation;
+                        ray scattered;
+                        if (first_hit.done || !world.scatter(r, rec, attenuation, scattered)) break;
+                        r = scattered;
+                    }
+                    albedo_sum += first_hit.albedo;
+                    normal_sum += first_hit.normal;
+                }
+                features.albedo.set(x, y, albedo_sum / samples);
+                features.normal.set(x, y, normal_sum / samples);
+            }
+        });
+    }
+
+    // normals mapped into 0..1 for looking at, the sky stays black
+    framebuffer normal_image() const {
+        framebuffer out(image_width, image_height);
+        for (int y = 0; y < image_height; y++) {
+            for (int x = 0; x < image_width; x++) {
+                vec3 n = features.normal.get(x, y);
+                if (n.near_zero()) continue;
+                color c = 0.5 * (n + vec3(1, 1, 1));
+                out.set(x, y, c * c); // squared, the writers' gamma 2 takes it back to c
+            }
+        }
+        return out;
+    }
+
     ray get_ray(int x, int y) const {
+        RT_STAT_INC(primary_rays);
+        return camera_ray(x, y);
+    }
+
+    // get_ray without counting it, for the feature pass
+    ray camera_ray(int x, int y) const {
         // pick a random point in pixel square to anti-alias
         vec3 random_offset = sample_square();
         point3 pixel_sample = pixel00_loc
@@ -101,13 +1057,20 @@ private:
         // if no defocus just send from center else simulate a lens disk
         point3 ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         vec3 ray_direction = pixel_sample - ray_origin;
-
         return ray(ray_origin, ray_direction);
     }
 
     vec3 sample_square() const {
         // pick point inside unit square centered at origin
-        return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+        double u, v;
+        thread_sampler().next_2d(u, v);
+        return vec3(u - 0.5, v - 0.5, 0);
+    }
+
+    // restarts the thread's generator and sampler for sample s of pixel x, y
+    void start_sample(int x, int y, int s) const {
+        seed_sample_rng(x, y, s, seed);
+        thread_sampler().start(sampler, x, y, s, samples_per_pixel, seed, std::max(image_width, image_height));
     }
 
     point3 defocus_disk_sample() const {
@@ -116,27 +1079,180 @@ private:
         return center + p.x() * defocus_disk_u + p.y() * defocus_disk_v;
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world) const {
+    // first_hit (if given) gets the sample's features, see note_hit
+    template <class Scene>
+    color sample_color(const ray& r, const Scene& world, feature_sample* first_hit = nullptr) const {
+        // wavefront only changes how whole tiles are rendered (render_wavefront), single
+        // samples of it (checkpoints, worker processes) are the same paths traced one by one
+        if (path_integrator != integrator::recursive)
+            return trace_path(r, world, first_hit);
+        return ray_color(r, max_depth, world, path_vertex(), first_hit);
+    }
+
+    template <class Scene>
+    color ray_color(const ray& r, int depth, const Scene& world, const path_vertex& from = path_vertex(),
+                    feature_sample* first_hit = nullptr) const {
         if (depth <= 0) {
+            RT_STAT_PATH_END(max_depth, max_depth);
             return color(0, 0, 0);
         }
 
+        if (depth < max_depth) RT_STAT_INC(secondary_rays); // anything but the camera's own ray
+
+        // no epsilon on t, scattered rays start off the surface already (spawn_ray)
         hit_record rec;
-        if (world.hit(r, interval(0.001, infinity), rec)) {
+        if (world.intersect(r, interval(0, infinity), rec)) {
+            note_hit(world, rec, first_hit);
+            color emission = hit_emission(world, r, rec, from);
+            ray scattered;
+            color attenuation;
+            if (world.scatter(r, rec, attenuation, scattered)) {
+                if (!samples_lights(world))
+                    return emission + attenuation * ray_color(scattered, depth - 1, world, path_vertex(), first_hit);
+                color direct = direct_light(world, r, rec);
+                return emission + direct
+                     + attenuation * ray_color(scattered, depth - 1, world, scatter_vertex(world, r, rec, scattered),
+                                               first_hit);
+            } else {
+                RT_STAT_PATH_END(absorbed, max_depth - depth);
+                return emission;
+            }
+        }
+
+        RT_STAT_PATH_END(missed, max_depth - depth);
+        note_miss(first_hit);
+        return background(r);
+    }
+
+    // same paths as ray_color but as a loop: throughput is the product of all attenuations
+    // so far, so nothing has to be multiplied on the way back up a call stack
+    template <class Scene>
+    color trace_path(ray r, const Scene& world, feature_sample* first_hit = nullptr) const {
+        color radiance(0, 0, 0);
+        color throughput(1, 1, 1);
+        path_vertex from;
+        bool sample_lights = samples_lights(world);
+
+        for (int depth = 0; depth < max_depth; depth++) {
+            if (depth > 0) RT_STAT_INC(secondary_rays);
+
+            hit_record rec;
+            if (!world.intersect(r, interval(0, infinity), rec)) {
+                RT_STAT_PATH_END(missed, depth);
+                note_miss(first_hit);
+                return radiance + throughput * background(r);
+            }
+            note_hit(world, rec, first_hit);
+            radiance += throughput * hit_emission(world, r, rec, from);
+
             ray scattered;
             color attenuation;
-            if (rec.surface_material->scatter(r, rec, attenuation, scattered)) {
-              return attenuation * ray_color(scattered, depth - 1, world);
-          }
-             else {
-                return color(0, 0, 0);
+            if (!world.scatter(r, rec, attenuation, scattered)) {
+                RT_STAT_PATH_END(absorbed, depth);
+                return radiance;
             }
+
+            if (sample_lights) {
+                radiance += throughput * direct_light(world, r, rec);
+                from = scatter_vertex(world, r, rec, scattered);
+            }
+
+            throughput = throughput * attenuation;
+            r = scattered;
+
+            // russian roulette: continue with probability p and divide by p if we do,
+            // so the expected value is unchanged but dim paths mostly stop here
+            if (depth + 1 >= roulette_start_depth) {
+                double p = std::fmin(0.95, std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())));
+                if (random_double() >= p) {
+                    RT_STAT_PATH_END(roulette, depth + 1);
+                    return radiance;
+                }
+                throughput /= p;
+            }
+        }
+
+        RT_STAT_PATH_END(max_depth, max_depth);
+        return radiance;
+    }
+
+    // a sample's features come from the first surface its path hits that isn't a mirror,
+    // tinted by the mirrors before it. the integrators call these at every hit and miss,
+    // once first_hit is done (or when there's none) they return right away
+    template <class Scene>
+    void note_hit(const Scene& world, const hit_record& rec, feature_sample* first_hit) const {
+        if (!first_hit || first_hit->done) return;
+        // a path that ends at a mirror keeps the mirror's own
+        first_hit->albedo = first_hit->tint * world.base_color(rec);
+        first_hit->normal = rec.surface_normal;
+        if (world.is_mirror(rec)) first_hit->tint = first_hit->albedo;
+        else first_hit->done = true;
+    }
+
+    // the sky is white with no normal
+    static void note_miss(feature_sample* first_hit) {
+        if (!first_hit || first_hit->done) return;
+        first_hit->albedo = first_hit->tint;
+        first_hit->normal = vec3(0, 0, 0);
+        first_hit->done = true;
+    }
+
+    template <class Scene>
+    bool samples_lights(const Scene& world) const {
+        return light_sampling && !world.lights().empty();
+    }
+
+    // light the hit surface gives off along r. if the previous vertex sampled lights, a
+    // light found by scattering only gets its share of the multiple importance sampling
+    // weight, direct_light there already counted the rest
+    template <class Scene>
+    color hit_emission(const Scene& world, const ray& r, const hit_record& rec, const path_vertex& from) const {
+        color emission = world.emitted(r, rec);
+        if (from.pdf <= 0 || emission.near_zero()) return emission;
+        return power_heuristic(from.pdf, world.lights().pdf(from.point, rec)) * emission;
+    }
+
+    // next event estimation: light arriving at the hit straight from a point on one of the
+    // lights, unless something is in the way. the shadow ray stops a little short of the
+    // light so it can't hit the light itself
+    template <class Scene>
+    color direct_light(const Scene& world, const ray& r, const hit_record& rec) const {
+        // mirrors and glass can't weigh a light sample (evaluate gives pdf 0), so no light
+        // is picked. the pair of sampler dimensions the light sample would take is skipped
+        // all the same, so the bounces after this one use the same dimensions whatever
+        // material this is
+        if (!world.has_pdf(rec)) {
+            thread_sampler().skip_2d();
+            return color(0, 0, 0);
         }
 
-        // background sky gradient from white to blue
+        light_sample s;
+        if (!world.lights().sample(rec.hit_point, s)) return color(0, 0, 0);
+
+        real scatter_pdf;
+        color f = world.evaluate(r, rec, s.direction, scatter_pdf);
+        if (scatter_pdf <= 0) return color(0, 0, 0);
+
+        RT_STAT_INC(shadow_rays);
+        if (world.occluded(spawn_ray(rec, s.direction), interval(0, s.distance * real(0.999))))
+            return color(0, 0, 0);
+        return (power_heuristic(s.pdf, scatter_pdf) / s.pdf) * f * s.radiance;
+    }
+
+    // the vertex the scattered ray leaves from, with the pdf scatter picked it with
+    template <class Scene>
+    path_vertex scatter_vertex(const Scene& world, const ray& r, const hit_record& rec, const ray& scattered) const {
+        path_vertex v;
+        v.point = rec.hit_point;
+        if (world.has_pdf(rec)) world.evaluate(r, rec, scattered.direction(), v.pdf);
+        return v;
+    }
+
+    // background sky gradient from white to blue
+    color background(const ray& r) const {
         vec3 unit_dir = unit_vector(r.direction());
         double t = 0.5 * (unit_dir.y() + 1.0);
-        return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+        return sky_brightness * ((1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0));
     }
 };
 
@@ -0,0 +1,171 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+// running sums of every sample a pixel got so far, enough to get its mean color and how
+// noisy that mean still is
+struct accum_pixel {
+    double sum[3];
+    double luminance_sum;
+    double luminance_squared_sum;
+    uint32_t samples;
+    uint32_t unused; // keeps the size a multiple of 8 in the file
+
+    color mean() const {
+        double scale = 1.0 / (samples > 0 ? samples : 1);
+        return color(sum[0] * scale, sum[1] * scale, sum[2] * scale);
+    }
+
+    // standard error of the mean brightness pushed through the sqrt gamma curve, the same
+    // measure camera's adaptive sampling uses: d(sqrt(L)) = dL / (2 sqrt(L))
+    double display_error() const {
+        if (samples < 2) return infinity;
+        double n = samples;
+        double mean = luminance_sum / n;
+        double variance = std::max(0.0, (luminance_squared_sum - n * mean * mean) / (n - 1));
+        return std::sqrt(variance / n) / (2 * std::sqrt(std::max(mean, 1e-4)));
+    }
+};
+
+// accumulation buffer of a progressive render, kept in a memory mapped file so the file
+// always holds every sample finished so far. a checkpoint is just a sync(), and a killed
+// render (even kill -9) loses at most the samples of the pixels it was working on
+//
+// the header records the image size, seed and a hash of the camera settings, a file that
+// doesn't match is refused instead of mixing samples of two different images. whether the
+// scene is the same as well is up to whoever resumes
+class accumulation_buffer {
+public:
+    // resumes from path if it holds a matching buffer, otherwise starts it empty
+    bool open(const std::string& path, int width, int height, uint64_t seed, uint64_t settings_hash) {
+        file_path = path;
+        size_t pixel_count = size_t(width) * height;
+        size_t bytes = sizeof(file_header) + pixel_count * sizeof(accum_pixel);
+
+        bool resuming = false;
+        {
+            mapped_file existing;
+            std::ifstream probe(path, std::ios::binary);
+            if (probe && existing.open(path)) {
+                file_header old;
+                if (existing.size() >= sizeof(old)) std::memcpy(&old, existing.data(), sizeof(old));
+                if (existing.size() != bytes || std::memcmp(old.magic, magic, sizeof(magic)) != 0 ||
+                    old.version != version || old.width != width || old.height != height ||
+                    old.seed != seed || old.settings_hash != settings_hash) {
+                    std::cerr << path << " is a checkpoint of a different render (size, seed or camera "
+                              << "settings), delete it to start over\n";
+                    return false;
+                }
+                resuming = true;
+            }
+        }
+
+        // a new buffer is an emptied file grown to size, which reads as zeros without
+        // writing (or bringing into memory) every pixel
+        if (!resuming) ::truncate(path.c_str(), 0);
+        if (!mapping.open_writable(path, bytes)) return false;
+
+        file_header& header = *reinterpret_cast<file_header*>(mapping.writable_data());
+        if (!resuming) {
+            header = file_header();
+            std::memcpy(header.magic, magic, sizeof(magic));
+            header.version = version;
+            header.width = width;
+            header.height = height;
+            header.seed = seed;
+            header.settings_hash = settings_hash;
+        }
+        pixel_data = reinterpret_cast<accum_pixel*>(mapping.writable_data() + sizeof(file_header));
+        image_width = width;
+        image_height = height;
+        return true;
+    }
+
+    accum_pixel& at(int x, int y) { return pixel_data[size_t(y) * image_width + x]; }
+    const accum_pixel& at(int x, int y) const { return pixel_data[size_t(y) * image_width + x]; }
+
+    // total samples in the buffer, to tell a fresh start from a resume. gives the rows back
+    // as it goes, a big buffer doesn't have to fit in memory
+    uint64_t total_samples() const {
+        uint64_t total = 0;
+        for (int y = 0; y < image_height; y++) {
+            for (int x = 0; x < image_width; x++) total += at(x, y).samples;
+            release_rows(y, y + 1);
+        }
+        return total;
+    }
+
+    bool checkpoint() {
+        if (mapping.sync()) return true;
+        std::cerr << "could not write checkpoint " << file_path << "\n";
+        return false;
+    }
+
+    // done with rows [y0, y1) for now, like framebuffer::release_rows: their memory pages
+    // are given back, the sums stay in the file
+    void release_rows(int y0, int y1) const {
+        if (y1 <= y0) return;
+        size_t row_bytes = size_t(image_width) * sizeof(accum_pixel);
+        mapping.release(sizeof(file_header) + size_t(y0) * row_bytes, size_t(y1 - y0) * row_bytes);
+    }
+
+    // the mean colors into image (width x height, in memory or mapped), a row at a time
+    // with the rows of both given back as they're done
+    void resolve(framebuffer& image) const {
+        for (int y = 0; y < image_height; y++) {
+            for (int x = 0; x < image_width; x++)
+                image.set(x, y, at(x, y).mean());
+            image.release_rows(y, y + 1);
+            release_rows(y, y + 1);
+        }
+    }
+
+private:
+    static constexpr uint32_t version = 1;
+    static constexpr char magic[8] = { 'R', 'T', 'A', 'C', 'C', 'U', 'M', 0 };
+
+    struct file_header {
+        char magic[8];
+        uint32_t version;
+        int32_t width, height;
+        uint32_t unused;
+        uint64_t seed;
+        uint64_t settings_hash;
+    };
+
+    static_assert(std::is_trivially_copyable<accum_pixel>::value, "pixels live in the file as raw bytes");
+    static_assert(sizeof(file_header) % alignof(accum_pixel) == 0, "pixels after the header stay aligned");
+
+    mapped_file mapping;
+    accum_pixel* pixel_data = nullptr;
+    int image_width = 0, image_height = 0;
+    std::string file_path;
+};
+
+// fnv-1a over raw bytes, for fingerprinting settings
+inline uint64_t hash_bytes(const void* data, size_t bytes, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < bytes; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+#endif
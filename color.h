@@ -14,18 +14,18 @@ inline double linear_to_gamma(double value_linear) {
     return 0; // black otherwise
 }
 
-// write final pixel color to output stream in PPM format
-void write_color(std::ostream& out, const color& raw_color) {
-    // apply gamma correction
-    double r_corrected = linear_to_gamma(raw_color.x());
-    double g_corrected = linear_to_gamma(raw_color.y());
-    double b_corrected = linear_to_gamma(raw_color.z());
-
+// gamma corrected and clamped 0..255 value of one channel
+inline int color_to_byte(double value_linear) {
     // clamp values before conversion
     static const interval intensity(0.000, 0.999);
-    int r_byte = int(256 * intensity.clamp(r_corrected));
-    int g_byte = int(256 * intensity.clamp(g_corrected));
-    int b_byte = int(256 * intensity.clamp(b_corrected));
+    return int(256 * intensity.clamp(linear_to_gamma(value_linear)));
+}
+
+// write final pixel color to output stream in PPM format
+inline void write_color(std::ostream& out, const color& raw_color) {
+    int r_byte = color_to_byte(raw_color.x());
+    int g_byte = color_to_byte(raw_color.y());
+    int b_byte = color_to_byte(raw_color.z());
 
     // write pixel as ASCII text
     out << r_byte << ' ' << g_byte << ' ' << b_byte << '\n';
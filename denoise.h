@@ -0,0 +1,258 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "framebuffer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+// first hit surface info of every pixel, averaged over the pixel's camera rays like the
+// color is. it's what guides the denoiser: an edge in these is a real edge, an edge that
+// only shows up in the color is most likely noise
+struct feature_buffers {
+    framebuffer albedo; // base color of the first hit's material, 1 where the sky was hit
+    framebuffer normal; // first hit normal facing the camera, 0 where the sky was hit
+    // variance of the mean brightness of the pixel's samples, how much of it is noise. empty
+    // if the render doesn't know (the filter guesses from the neighbours' brightness then)
+    std::vector<float> variance;
+};
+
+// the features of one sample, filled in by the integrator as its path goes (camera.h
+// note_hit / note_miss). a perfect mirror is looked through, its color goes into tint,
+// so the reflected edges guide the filter instead of the smooth mirror. anything else
+// (glass too, it picks reflection or refraction at random) is the surface that counts
+struct feature_sample {
+    color albedo = color(0, 0, 0);
+    vec3 normal = vec3(0, 0, 0);
+    color tint = color(1, 1, 1);
+    bool done = false;
+};
+
+// the feature_samples of a pixel added up, with the brightness of the samples' colors
+struct feature_sum {
+    color albedo = color(0, 0, 0);
+    vec3 normal = vec3(0, 0, 0);
+    double luminance_sum = 0, luminance_squared_sum = 0;
+
+    void add(const feature_sample& s, const color& sample) {
+        albedo += s.albedo;
+        normal += s.normal;
+        double luminance = 0.2126 * sample.x() + 0.7152 * sample.y() + 0.0722 * sample.z();
+        luminance_sum += luminance;
+        luminance_squared_sum += luminance * luminance;
+    }
+
+    // variance of the mean of the brightness of samples samples, 0 for fewer than 2
+    float variance(int samples) const {
+        if (samples < 2) return 0;
+        double mean = luminance_sum / samples;
+        return float(std::max(0.0, (luminance_squared_sum / samples - mean * mean) / (samples - 1)));
+    }
+};
+
+struct denoise_settings {
+    int iterations = 3;          // filter passes, pass k takes taps 2^k pixels apart
+    double color_sigma = 4;      // how many standard deviations of noise still count as noise
+    double normal_sharpness = 64; // higher stops the filter at smaller bends of the surface
+    double albedo_sigma = 0.1;   // base color difference the filter still averages over
+};
+
+// edge avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance guided
+// color weight of SVGF (Schied et al. 2017), spatial only: every pass is a 5x5 b-spline
+// kernel with holes, the taps spreading out 1, 2, 4 .. pixels, so 3 passes cover 29x29
+// pixels for 75 taps per pixel. each tap is weighted down by how different its normal,
+// albedo and brightness are from the center's
+//
+// the filter runs on the color divided by the albedo (the light arriving at the surface),
+// which is smooth across texture and material edges, and multiplies the albedo back at the
+// end, so the filter never has to blur over a material edge to remove the noise next to it
+//
+// the brightness weight needs to know how noisy the center pixel is: before the first
+// pass every pixel gets the variance its samples measured (feature_buffers::variance),
+// averaged over the 5x5 pixels around it that share its surface since a few samples give
+// a noisy variance too. each pass filters the variance along with the color. without
+// measured variances it's the variance of the brightness of the 7x7 pixels around it on
+// its surface, which also counts real shading differences as noise
+class atrous_denoiser {
+public:
+    denoise_settings settings;
+    int thread_count = 0; // 0 = every core
+    thread_pool* shared_pool = nullptr; // runs on this one instead of its own if set
+
+    framebuffer denoise(const framebuffer& image, const feature_buffers& features) {
+        width = image.width();
+        height = image.height();
+        size_t n = size_t(width) * height;
+        normal_scale = float(settings.normal_sharpness);
+        albedo_scale = float(1 / (settings.albedo_sigma * settings.albedo_sigma));
+
+        // the guides of a pixel in one record. averaged normals are shorter where a pixel
+        // saw a bend or an edge, the weights want unit ones so a pixel always weighs fully
+        // against itself. the sky gets a 4th axis of its own: sky to sky is a dot of 1,
+        // sky to surface a dot of 0, so it needs no special case in the inner loop
+        guides.resize(n);
+        const float* normal = features.normal.data();
+        const float* albedo = features.albedo.data();
+        for (size_t i = 0; i < n; i++) {
+            const float* v = normal + 3 * i;
+            float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+            guide& g = guides[i];
+            for (int k = 0; k < 3; k++) {
+                g.normal[k] = length > 0 ? v[k] / length : 0;
+                g.albedo[k] = albedo[3 * i + k];
+            }
+            g.normal[3] = length > 0 ? 0 : 1;
+        }
+
+        // demodulate
+        light.resize(3 * n);
+        const float* c = image.data();
+        for (size_t i = 0; i < 3 * n; i++) light[i] = c[i] / std::max(albedo[i], min_albedo);
+        luminance.resize(n);
+
+        // the measured variance is of the color's brightness, the light's is about that over
+        // the albedo's brightness squared
+        measured.clear();
+        if (features.variance.size() == n) {
+            measured.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                const float* a = albedo + 3 * i;
+                float brightness = std::max(0.2126f * a[0] + 0.7152f * a[1] + 0.0722f * a[2], min_albedo);
+                measured[i] = features.variance[i] / (brightness * brightness);
+            }
+        }
+
+        std::unique_ptr<thread_pool> own_pool;
+        if (!shared_pool) own_pool = std::make_unique<thread_pool>(thread_count);
+        thread_pool& pool = shared_pool ? *shared_pool : *own_pool;
+        int bands = (height + band_rows - 1) / band_rows;
+        auto for_rows = [&](void (atrous_denoiser::*row_task)(int, int), int step) {
+            pool.parallel_for(bands, [&](int band) {
+                for (int y = band * band_rows; y < std::min(height, (band + 1) * band_rows); y++)
+                    (this->*row_task)(y, step);
+            });
+        };
+
+        variance.resize(n);
+        compute_luminance();
+        for_rows(&atrous_denoiser::estimate_variance, 1);
+
+        filtered.resize(3 * n);
+        filtered_variance.resize(n);
+        for (int pass = 0; pass < settings.iterations; pass++) {
+            if (pass > 0) compute_luminance();
+            for_rows(&atrous_denoiser::filter_row, 1 << pass);
+            std::swap(light, filtered);
+            std::swap(variance, filtered_variance);
+        }
+
+        // remodulate
+        framebuffer result(width, height);
+        float* out = result.data();
+        for (size_t i = 0; i < 3 * n; i++) out[i] = light[i] * std::max(albedo[i], min_albedo);
+        return result;
+    }
+
+private:
+    static constexpr int band_rows = 8;
+    static constexpr float min_albedo = 0.01f; // black surfaces would divide by 0
+    // taps weighted below e^-16 are skipped: they change nothing next to the center's own
+    // weight, and their squares for the variance would be denormals, which are slow
+    static constexpr float min_log_weight = -16;
+
+    struct guide {
+        float normal[4];
+        float albedo[3];
+        float unused; // 32 bytes, two per cache line
+    };
+
+    int width = 0, height = 0;
+    float normal_scale = 0, albedo_scale = 0;
+    std::vector<guide> guides;
+    std::vector<float> light, filtered;     // demodulated color, 3 per pixel
+    std::vector<float> luminance;           // of light
+    std::vector<float> variance, filtered_variance;
+    std::vector<float> measured;            // variance of light from the samples, if known
+
+    void compute_luminance() {
+        for (size_t i = 0; i < luminance.size(); i++)
+            luminance[i] = 0.2126f * light[3 * i] + 0.7152f * light[3 * i + 1] + 0.0722f * light[3 * i + 2];
+    }
+
+    // log of the normal and albedo weights between two pixels. normal: dot^sharpness,
+    // written as exp(sharpness * (dot - 1)) which is about the same near 1 and saves a pow
+    float log_surface_weight(const guide& p, const guide& q) const {
+        float dot = p.normal[0] * q.normal[0] + p.normal[1] * q.normal[1] + p.normal[2] * q.normal[2]
+                  + p.normal[3] * q.normal[3];
+        float da0 = p.albedo[0] - q.albedo[0];
+        float da1 = p.albedo[1] - q.albedo[1];
+        float da2 = p.albedo[2] - q.albedo[2];
+        return normal_scale * (dot - 1) - (da0 * da0 + da1 * da1 + da2 * da2) * albedo_scale;
+    }
+
+    void estimate_variance(int y, int) {
+        int radius = measured.empty() ? 3 : 2;
+        for (int x = 0; x < width; x++) {
+            size_t p = size_t(y) * width + x;
+            float sum_w = 0, sum = 0, sum_sq = 0, sum_measured = 0;
+            for (int qy = std::max(0, y - radius); qy <= std::min(height - 1, y + radius); qy++) {
+                for (int qx = std::max(0, x - radius); qx <= std::min(width - 1, x + radius); qx++) {
+                    size_t q = size_t(qy) * width + qx;
+                    float log_w = log_surface_weight(guides[p], guides[q]);
+                    if (log_w < min_log_weight) continue;
+                    float w = std::exp(log_w);
+                    float l = luminance[q];
+                    sum_w += w;
+                    sum += w * l;
+                    sum_sq += w * l * l;
+                    if (!measured.empty()) sum_measured += w * measured[q];
+                }
+            }
+            float mean = sum / sum_w;
+            variance[p] = measured.empty() ? std::max(0.0f, sum_sq / sum_w - mean * mean) : sum_measured / sum_w;
+        }
+    }
+
+    void filter_row(int y, int step) {
+        static const float kernel[3] = { 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+        for (int x = 0; x < width; x++) {
+            size_t p = size_t(y) * width + x;
+            const guide& gp = guides[p];
+            float lp = luminance[p];
+            // a little floor so a flat region (no noise left) can still be averaged
+            float color_scale = 1 / (float(settings.color_sigma) * std::sqrt(variance[p]) + 1e-4f);
+
+            float sum_w = 0, sum_w2_var = 0;
+            float sum[3] = { 0, 0, 0 };
+            for (int dy = -2; dy <= 2; dy++) {
+                int qy = y + dy * step;
+                if (qy < 0 || qy >= height) continue;
+                for (int dx = -2; dx <= 2; dx++) {
+                    int qx = x + dx * step;
+                    if (qx < 0 || qx >= width) continue;
+                    size_t q = size_t(qy) * width + qx;
+
+                    float log_w = log_surface_weight(gp, guides[q]) - std::fabs(lp - luminance[q]) * color_scale;
+                    if (log_w < min_log_weight) continue;
+                    float w = kernel[std::abs(dx)] * kernel[std::abs(dy)] * std::exp(log_w);
+                    const float* c = &light[3 * q];
+                    sum_w += w;
+                    sum_w2_var += w * w * variance[q];
+                    sum[0] += w * c[0];
+                    sum[1] += w * c[1];
+                    sum[2] += w * c[2];
+                }
+            }
+
+            // the center tap has a weight of at least kernel[0]^2, sum_w > 0
+            for (int i = 0; i < 3; i++) filtered[3 * p + i] = sum[i] / sum_w;
+            filtered_variance[p] = sum_w2_var / (sum_w * sum_w);
+        }
+    }
+};
+
+#endif
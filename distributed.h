@@ -0,0 +1,366 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// renders one image with several worker processes on this machine. the coordinator forks
+// the workers once the scene is loaded, so every worker has the same scene without loading
+// it again, and talks to each one over a unix socketpair
+//
+// the work is a list of tasks, a tile plus a range of sample indices. with passes > 1 the
+// samples of every pixel are split into that many ranges and all tiles of one range come
+// before the next, so the image fills in progressively. a worker answers a task with the
+// sum of those samples for every pixel of the tile, the coordinator adds sums and sample
+// counts per pixel and divides at the end, which weights every partial result by how many
+// samples it holds. samples are seeded by their index (rng.h), so which process rendered
+// a range doesn't change the result and with one pass the image is the same as in-process
+//
+// a worker that dies (read/write error, eof) or stops answering (still has its task when
+// the task's deadline passes, task_timeout) gets killed, its task goes back to the front
+// of the queue for the others. if no worker is left the coordinator renders what's left
+// itself
+class process_farm {
+public:
+    int worker_count = 2;
+    int tile_size = 16;
+    int passes = 1;
+    bool show_progress = true;
+    // seconds a worker gets for one task before it counts as hung. 0 = 10 times the slowest
+    // task so far but at least min_task_timeout, so it follows the scene and sample count
+    double task_timeout = 0;
+    // testing the failure path: worker 0 exits without answering when it gets its
+    // crash_after-th task, or sends the start of its hang_after-th answer and then keeps
+    // running without the rest (0 = never)
+    int crash_after = 0;
+    int hang_after = 0;
+
+    // sample_sum(x, y, first_sample, count) returns the sum of those samples of pixel x, y.
+    // image gets the mean, sample_counts the samples every pixel got (row major)
+    template <class SampleSum>
+    void render(int width, int height, int samples_per_pixel, const SampleSum& sample_sum,
+                framebuffer& image, std::vector<int>& sample_counts) {
+        make_tasks(width, height, samples_per_pixel);
+        sums.assign(size_t(width) * height * 3, 0.0);
+        sample_counts.assign(size_t(width) * height, 0);
+
+        std::deque<int> queue;
+        for (int i = 0; i < int(tasks.size()); i++) queue.push_back(i);
+
+        spawn_workers(sample_sum);
+
+        size_t done = 0;
+        std::vector<double> buffer;
+        slowest_task = 0;
+        auto assign = [&](worker& w) {
+            if (queue.empty() || w.fd < 0 || w.task >= 0) return;
+            w.task = queue.front();
+            queue.pop_front();
+            w.started = farm_clock::now();
+            if (!send_all(w.fd, &tasks[size_t(w.task)], sizeof(tile_task))) fail(w, queue);
+        };
+        for (auto& w : workers) assign(w);
+
+        while (done < tasks.size()) {
+            std::vector<pollfd> waiting;
+            std::vector<worker*> owners;
+            for (auto& w : workers) {
+                if (w.fd < 0 || w.task < 0) continue;
+                waiting.push_back(pollfd{ w.fd, POLLIN, 0 });
+                owners.push_back(&w);
+            }
+
+            // nobody left to ask, the rest is done here
+            if (waiting.empty()) {
+                while (!queue.empty()) {
+                    const tile_task& task = tasks[size_t(queue.front())];
+                    queue.pop_front();
+                    run_task(sample_sum, task, buffer);
+                    merge(task, buffer, width, sample_counts);
+                    done++;
+                    report_progress(tasks.size() - done);
+                }
+                break;
+            }
+
+            // wait until an answer comes or the oldest task runs out of time
+            double limit = current_timeout();
+            auto now = farm_clock::now();
+            double wait = limit;
+            for (const worker* w : owners)
+                wait = std::min(wait, limit - seconds_between(w->started, now));
+            int wait_ms = int(std::ceil(std::max(0.0, wait) * 1000));
+
+            if (poll(waiting.data(), waiting.size(), wait_ms) < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "poll failed, stopping the workers\n";
+                for (auto& w : workers) fail(w, queue);
+                continue;
+            }
+
+            now = farm_clock::now();
+            for (size_t i = 0; i < waiting.size(); i++) {
+                worker& w = *owners[i];
+                if (waiting[i].revents == 0) {
+                    if (seconds_between(w.started, now) >= limit) fail(w, queue, "stopped answering");
+                    continue;
+                }
+                const tile_task& task = tasks[size_t(w.task)];
+                auto deadline = w.started + std::chrono::duration_cast<farm_clock::duration>(
+                                                std::chrono::duration<double>(limit));
+                if (!receive_result(w.fd, task, buffer, deadline)) {
+                    fail(w, queue, farm_clock::now() >= deadline ? "stopped answering" : "failed");
+                    continue;
+                }
+                slowest_task = std::max(slowest_task, seconds_between(w.started, farm_clock::now()));
+                merge(task, buffer, width, sample_counts);
+                done++;
+                report_progress(tasks.size() - done);
+                w.task = -1;
+            }
+            // tasks of failed workers go to whoever is idle now, not only to the next one
+            // that finishes
+            for (auto& w : workers) assign(w);
+        }
+
+        stop_workers();
+        if (show_progress) std::clog << "\rDone.                 \n";
+
+        image = framebuffer(width, height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t p = size_t(y) * width + x;
+                // times the reciprocal like camera::render_pixel, so one pass matches it exactly
+                double scale = 1.0 / std::max(1, sample_counts[p]);
+                image.set(x, y, color(sums[3 * p] * scale, sums[3 * p + 1] * scale, sums[3 * p + 2] * scale));
+            }
+        }
+    }
+
+private:
+    // sample_count 0 tells a worker to exit
+    struct tile_task {
+        int32_t x0, y0, x1, y1;
+        int32_t first_sample, sample_count;
+    };
+
+    using farm_clock = std::chrono::steady_clock;
+
+    struct worker {
+        pid_t pid = -1;
+        int fd = -1;
+        int task = -1; // index of the task it's working on, -1 if idle
+        farm_clock::time_point started; // when it got the task
+    };
+
+    static constexpr double min_task_timeout = 60;
+
+    std::vector<tile_task> tasks;
+    std::vector<worker> workers;
+    std::vector<double> sums; // per pixel rgb sums of every sample merged so far
+    double slowest_task = 0;  // seconds, of the tasks answered so far
+
+    double current_timeout() const {
+        if (task_timeout > 0) return task_timeout;
+        return std::max(min_task_timeout, 10 * slowest_task);
+    }
+
+    static double seconds_between(farm_clock::time_point from, farm_clock::time_point to) {
+        return std::chrono::duration<double>(to - from).count();
+    }
+
+    void make_tasks(int width, int height, int samples_per_pixel) {
+        tasks.clear();
+        int tile = tile_size > 0 ? tile_size : 16;
+        int pass_count = std::max(1, std::min(passes, samples_per_pixel));
+        for (int pass = 0; pass < pass_count; pass++) {
+            int first = int(int64_t(samples_per_pixel) * pass / pass_count);
+            int last = int(int64_t(samples_per_pixel) * (pass + 1) / pass_count);
+            for (int y0 = 0; y0 < height; y0 += tile)
+                for (int x0 = 0; x0 < width; x0 += tile)
+                    tasks.push_back(tile_task{ x0, y0, std::min(x0 + tile, width), std::min(y0 + tile, height),
+                                               first, last - first });
+        }
+    }
+
+    template <class SampleSum>
+    static void run_task(const SampleSum& sample_sum, const tile_task& task, std::vector<double>& out) {
+        out.clear();
+        for (int y = task.y0; y < task.y1; y++) {
+            for (int x = task.x0; x < task.x1; x++) {
+                color sum = sample_sum(x, y, task.first_sample, task.sample_count);
+                out.push_back(sum.x());
+                out.push_back(sum.y());
+                out.push_back(sum.z());
+            }
+        }
+    }
+
+    static size_t result_size(const tile_task& task) {
+        return size_t(task.x1 - task.x0) * (task.y1 - task.y0) * 3;
+    }
+
+    void merge(const tile_task& task, const std::vector<double>& tile_sums, int width,
+               std::vector<int>& sample_counts) {
+        size_t i = 0;
+        for (int y = task.y0; y < task.y1; y++) {
+            for (int x = task.x0; x < task.x1; x++) {
+                size_t p = size_t(y) * width + x;
+                sums[3 * p] += tile_sums[i++];
+                sums[3 * p + 1] += tile_sums[i++];
+                sums[3 * p + 2] += tile_sums[i++];
+                sample_counts[p] += task.sample_count;
+            }
+        }
+    }
+
+    // a result is the task it answers followed by the sums, both have to match what we sent
+    // and arrive before the task's deadline
+    bool receive_result(int fd, const tile_task& task, std::vector<double>& tile_sums,
+                        farm_clock::time_point deadline) {
+        tile_task echo;
+        if (!recv_all(fd, &echo, sizeof(echo), deadline)) return false;
+        if (echo.x0 != task.x0 || echo.y0 != task.y0 || echo.first_sample != task.first_sample) return false;
+        tile_sums.resize(result_size(task));
+        return recv_all(fd, tile_sums.data(), tile_sums.size() * sizeof(double), deadline);
+    }
+
+    template <class SampleSum>
+    void spawn_workers(const SampleSum& sample_sum) {
+        workers.clear();
+        for (int i = 0; i < worker_count; i++) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                std::cerr << "could not create a socket for worker " << i << "\n";
+                break;
+            }
+
+            pid_t pid = fork();
+            if (pid < 0) {
+                std::cerr << "could not start worker " << i << "\n";
+                ::close(fds[0]);
+                ::close(fds[1]);
+                break;
+            }
+            if (pid == 0) {
+                ::close(fds[0]);
+                for (auto& w : workers) ::close(w.fd); // the other workers' coordinator ends
+                // _exit, not exit: the coordinator's stdio buffers and static objects are
+                // copies in here and must not be flushed or destroyed a second time
+                _exit(worker_loop(sample_sum, fds[1], i == 0 ? crash_after : 0, i == 0 ? hang_after : 0));
+            }
+
+            ::close(fds[1]);
+            worker w;
+            w.pid = pid;
+            w.fd = fds[0];
+            workers.push_back(w);
+        }
+    }
+
+    template <class SampleSum>
+    static int worker_loop(const SampleSum& sample_sum, int fd, int crash_after, int hang_after) {
+        std::vector<double> tile_sums;
+        int received = 0;
+        while (true) {
+            tile_task task;
+            if (!recv_all(fd, &task, sizeof(task))) return 1;
+            if (task.sample_count == 0) return 0;
+            if (++received == crash_after) return 2;
+            if (received == hang_after) {
+                send_all(fd, &task, sizeof(task));
+                while (true) pause(); // alive but silent until the coordinator kills it
+            }
+
+            run_task(sample_sum, task, tile_sums);
+            if (!send_all(fd, &task, sizeof(task)) ||
+                !send_all(fd, tile_sums.data(), tile_sums.size() * sizeof(double)))
+                return 1;
+        }
+    }
+
+    void fail(worker& w, std::deque<int>& queue, const char* what = "failed") {
+        if (w.fd < 0) return;
+        std::cerr << "\nworker " << w.pid << " " << what;
+        if (w.task >= 0) {
+            std::cerr << ", its tile goes to another one";
+            queue.push_front(w.task);
+        }
+        std::cerr << "\n";
+        ::close(w.fd);
+        kill(w.pid, SIGKILL);
+        waitpid(w.pid, nullptr, 0);
+        w.fd = -1;
+        w.task = -1;
+    }
+
+    void stop_workers() {
+        tile_task stop{ 0, 0, 0, 0, 0, 0 };
+        for (auto& w : workers) {
+            if (w.fd < 0) continue;
+            send_all(w.fd, &stop, sizeof(stop));
+            ::close(w.fd);
+            waitpid(w.pid, nullptr, 0);
+            w.fd = -1;
+        }
+        workers.clear();
+    }
+
+    void report_progress(size_t remaining) const {
+        if (show_progress) std::clog << "\rTiles remaining: " << remaining << ' ' << std::flush;
+    }
+
+    // MSG_NOSIGNAL so writing to a dead worker is an error here instead of a SIGPIPE
+    static bool send_all(int fd, const void* data, size_t bytes) {
+        const char* p = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            bytes -= size_t(n);
+        }
+        return true;
+    }
+
+    // with a deadline every read waits for data only until then, so a worker that stops in
+    // the middle of an answer can't hold the coordinator up. what's already there is read
+    // even after it
+    static bool recv_all(int fd, void* data, size_t bytes,
+                         farm_clock::time_point deadline = farm_clock::time_point::max()) {
+        char* p = static_cast<char*>(data);
+        while (bytes > 0) {
+            if (deadline != farm_clock::time_point::max()) {
+                double left = seconds_between(farm_clock::now(), deadline);
+                pollfd ready{ fd, POLLIN, 0 };
+                int r = poll(&ready, 1, int(std::ceil(std::max(0.0, left) * 1000)));
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0) return false;
+            }
+            ssize_t n = recv(fd, p, bytes, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            bytes -= size_t(n);
+        }
+        return true;
+    }
+};
+
+#endif
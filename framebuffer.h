@@ -0,0 +1,132 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+// the rendered image kept in memory as linear (not gamma corrected) float rgb
+// rows go top to bottom, 3 floats per pixel, so a whole row or the whole image
+// can be handed to a writer as one block
+//
+// map_file() puts the pixels in a scratch file instead (out of core): the os writes them
+// to the file and only the pages in use stay in memory, the renderer gives back finished
+// rows (release_rows), so a 16k image doesn't need 2 GB of ram. copies of a mapped
+// framebuffer are ordinary in memory ones
+class framebuffer {
+public:
+    framebuffer() {}
+
+    framebuffer(int width, int height)
+        : image_width(width), image_height(height), pixels(size_t(width) * height * 3, 0.0f) {
+        values = pixels.data();
+    }
+
+    framebuffer(const framebuffer& other)
+        : image_width(other.image_width), image_height(other.image_height),
+          pixels(other.values, other.values + other.value_count()) {
+        values = pixels.data();
+    }
+
+    framebuffer(framebuffer&& other) noexcept { *this = std::move(other); }
+
+    framebuffer& operator=(const framebuffer& other) {
+        if (this != &other) *this = framebuffer(other);
+        return *this;
+    }
+
+    framebuffer& operator=(framebuffer&& other) noexcept {
+        if (this != &other) {
+            image_width = other.image_width;
+            image_height = other.image_height;
+            pixels = std::move(other.pixels);
+            mapping = std::move(other.mapping);
+            values = mapping.is_open() ? reinterpret_cast<float*>(mapping.writable_data()) : pixels.data();
+            other.image_width = other.image_height = 0;
+            other.values = nullptr;
+        }
+        return *this;
+    }
+
+    // a black width x height image in a new scratch file in directory. the file is deleted
+    // again right away, the mapping keeps its space until the framebuffer goes (or the
+    // process dies), so nothing is left behind
+    bool map_file(const std::string& directory, int width, int height) {
+        std::string path = directory + "/framebuffer-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0) {
+            std::cerr << "could not create a framebuffer file in " << directory << "\n";
+            return false;
+        }
+        ::close(fd);
+
+        mapped_file file;
+        bool mapped = file.open_writable(path, size_t(width) * height * 3 * sizeof(float));
+        ::unlink(path.c_str());
+        if (!mapped) return false;
+
+        *this = framebuffer();
+        image_width = width;
+        image_height = height;
+        mapping = std::move(file);
+        values = reinterpret_cast<float*>(mapping.writable_data());
+        return true;
+    }
+
+    bool is_mapped() const { return mapping.is_open(); }
+
+    // done with rows [y0, y1) for now: a mapped framebuffer lets go of the memory pages
+    // that lie completely inside them, the values stay in the file and come back when
+    // read again. an in memory framebuffer stays as it is
+    void release_rows(int y0, int y1) const {
+        if (!is_mapped() || y1 <= y0) return;
+        size_t row_bytes = size_t(image_width) * 3 * sizeof(float);
+        mapping.release(size_t(y0) * row_bytes, size_t(y1 - y0) * row_bytes);
+    }
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    void set(int x, int y, const color& c) {
+        float* p = pixel(x, y);
+        p[0] = float(c.x());
+        p[1] = float(c.y());
+        p[2] = float(c.z());
+    }
+
+    color get(int x, int y) const {
+        const float* p = pixel(x, y);
+        return color(p[0], p[1], p[2]);
+    }
+
+    float* row(int y) { return values + size_t(y) * image_width * 3; }
+    const float* row(int y) const { return values + size_t(y) * image_width * 3; }
+
+    float* data() { return values; }
+    const float* data() const { return values; }
+
+    // back to black, keeps the size
+    void clear() { std::fill(values, values + value_count(), 0.0f); }
+
+private:
+    int image_width = 0;
+    int image_height = 0;
+    std::vector<float> pixels;
+    mapped_file mapping;      // instead of pixels after map_file
+    float* values = nullptr; // pixels.data() or the mapping
+
+    size_t value_count() const { return size_t(image_width) * image_height * 3; }
+
+    float* pixel(int x, int y) { return row(y) + size_t(x) * 3; }
+    const float* pixel(int x, int y) const { return row(y) + size_t(x) * 3; }
+};
+
+#endif
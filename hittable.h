@@ -1,23 +1,43 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
 #include "ray.h"
 
-class material;
+#include <cmath>
+#include <cstdint>
+#include <limits>
 
+class hittable;
+
+// filled in two steps: while looking for the closest hit an object only writes hit_t and
+// who was hit, the surface info below is computed once for the final closest hit
+// (by hittable::intersect), so rejected candidates cost almost nothing
 class hit_record {
 public:
+    // distance from ray origin to intersection
+    real hit_t;
+
+    // primitive that was hit, and which element of it for objects holding many (sphere_soa)
+    const hittable* hit_object = nullptr;
+    uint32_t primitive_index = 0;
+
+    // hits inside an instance (instance.h): hit_object is the instance and these say what
+    // was hit in its geometry, which of an instance_set's instances that was
+    const hittable* inner_object = nullptr;
+    uint32_t instance_index = 0;
+
     // location where the ray hit the object
     point3 hit_point;
 
+    // bound on the rounding error of hit_point per axis, see spawn_ray
+    vec3 point_error;
+
     // surface normal at the point of contact
     vec3 surface_normal;
 
-    // pointer to the material of the object hit
-    shared_ptr<material> surface_material;
-
-    // distance from ray origin to intersection
-    double hit_t;
+    // index of the object's material in the scene's material_table
+    uint32_t material_id = 0;
 
     // determines if the hit was from outside the surface
     bool is_front_face;
@@ -29,12 +49,54 @@ public:
     }
 };
 
+// bound on the relative rounding error of n floating point operations (pbrt's gamma)
+constexpr real rounding_error(int n) {
+    return n * (std::numeric_limits<real>::epsilon() / 2) / (1 - n * (std::numeric_limits<real>::epsilon() / 2));
+}
+
+// ray leaving the surface of rec in direction dir. the origin is pushed off the surface
+// along the normal, to the side dir points to, far enough to get past the rounding error
+// of hit_point, so the new ray can't hit the same surface again right away (shadow acne).
+// the distance scales with the coordinates, which a fixed t > 0.001 doesn't, and that's
+// what breaks first in the float build
+inline ray spawn_ray(const hit_record& rec, const vec3& dir) {
+    const vec3& n = rec.surface_normal;
+    real d = std::fabs(n.x()) * rec.point_error.x() + std::fabs(n.y()) * rec.point_error.y()
+           + std::fabs(n.z()) * rec.point_error.z();
+    vec3 offset = d * n;
+    if (dot(dir, n) < 0) offset = -offset;
+    return ray(rec.hit_point + offset, dir);
+}
+
 class hittable {
 public:
     virtual ~hittable() = default;
 
     // every hittable object must implement this to define how it's intersected by a ray
+    // it only fills hit_t, hit_object and primitive_index, and only when it returns true
     virtual bool hit(const ray& r, interval ray_bounds, hit_record& rec) const = 0;
+
+    // fills hit_point, point_error, normal, face and material of a hit found by hit().
+    // pure so a new primitive can't forget it and hand shading an unset record, objects
+    // that only group others (lists, bvh) never end up in hit_object and leave it empty
+    virtual void compute_surface(const ray& r, hit_record& rec) const = 0;
+
+    // whether anything is hit inside ray_bounds at all, for shadow rays. objects can stop
+    // at the first hit they find instead of looking for the closest one
+    virtual bool hit_any(const ray& r, interval ray_bounds) const {
+        hit_record rec;
+        return hit(r, ray_bounds, rec);
+    }
+
+    // box that fully encloses the object, used to build the bvh
+    virtual aabb bounding_box() const = 0;
+
+    // closest hit with its surface info, what shading code should call
+    bool intersect(const ray& r, interval ray_bounds, hit_record& rec) const {
+        if (!hit(r, ray_bounds, rec)) return false;
+        rec.hit_object->compute_surface(r, rec);
+        return true;
+    }
 };
 
 #endif
@@ -2,6 +2,7 @@
 #define HITTABLE_LIST_H
 
 #include "hittable.h"
+#include "stats.h"
 
 #include <memory>
 #include <vector>
@@ -17,28 +18,44 @@ public:
     hittable_list() {}
     hittable_list(shared_ptr<hittable> obj) { add(obj); }
 
-    void clear() { objects.clear(); } // remove everything from the scene
+    void clear() { objects.clear(); bbox = aabb(); } // remove everything from the scene
 
     void add(shared_ptr<hittable> obj) {
         objects.push_back(obj); // add a new object to the scene
+        bbox = aabb(bbox, obj->bounding_box());
     }
 
     // checks if any object in the list is hit by the ray
+    // objects only write the record when they hit something closer, so no copy is needed
     bool hit(const ray& r, interval ray_t, hit_record& closest_hit) const override {
-        hit_record temp_hit; // stores hit info for current object
+        RT_STAT_INC(list_hit_calls);
         bool any_hit = false;
         auto closest_so_far = ray_t.max; // we keep track of closest t
 
         for (const auto& obj : objects) {
-            if (obj->hit(r, interval(ray_t.min, closest_so_far), temp_hit)) {
+            if (obj->hit(r, interval(ray_t.min, closest_so_far), closest_hit)) {
                 any_hit = true;
-                closest_so_far = temp_hit.hit_t;
-                closest_hit = temp_hit;
+                closest_so_far = closest_hit.hit_t;
             }
         }
 
         return any_hit; // if we hit at least one object
     }
+
+    bool hit_any(const ray& r, interval ray_t) const override {
+        RT_STAT_INC(list_hit_calls);
+        for (const auto& obj : objects)
+            if (obj->hit_any(r, ray_t)) return true;
+        return false;
+    }
+
+    // hit() leaves one of the objects in hit_object, never the list
+    void compute_surface(const ray& r, hit_record& rec) const override {}
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    aabb bbox; // grows as objects are added
 };
 
 #endif
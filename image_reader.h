@@ -0,0 +1,93 @@
+#ifndef IMAGE_READER_H
+#define IMAGE_READER_H
+
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// reads back what the ppm (P3/P6) and pfm writers produce, so renders can be compared.
+// ppm bytes are gamma corrected, they get turned back into linear values (squared) so the
+// framebuffer means the same thing whichever format the image came from. png isn't read,
+// write pfm for comparisons anyway, the 8 bit formats hide most of the differences
+inline bool read_ppm(std::istream& in, bool binary, framebuffer& image) {
+    int width = 0, height = 0, max_value = 0;
+    if (!(in >> width >> height >> max_value) || width <= 0 || height <= 0 || max_value != 255)
+        return false;
+    in.get(); // the single whitespace before the raster
+
+    image = framebuffer(width, height);
+    size_t values = size_t(width) * height * 3;
+    std::vector<unsigned char> bytes(values);
+    if (binary) {
+        in.read(reinterpret_cast<char*>(bytes.data()), std::streamsize(values));
+    } else {
+        for (size_t i = 0; i < values; i++) {
+            int v;
+            if (!(in >> v)) return false;
+            bytes[i] = (unsigned char)v;
+        }
+    }
+    if (!in) return false;
+
+    // color_to_byte maps [0, 1) onto 256 steps, take the middle of each step
+    for (size_t i = 0; i < values; i++) {
+        float gamma = (bytes[i] + 0.5f) / 256;
+        image.data()[i] = gamma * gamma;
+    }
+    return true;
+}
+
+// pfm byte order comes from the sign of the scale, this fixes up the other one
+inline void swap_float_bytes(float* values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        unsigned char* b = reinterpret_cast<unsigned char*>(&values[i]);
+        std::swap(b[0], b[3]);
+        std::swap(b[1], b[2]);
+    }
+}
+
+inline bool read_pfm(std::istream& in, framebuffer& image) {
+    int width = 0, height = 0;
+    double scale = 0;
+    if (!(in >> width >> height >> scale) || width <= 0 || height <= 0 || scale == 0)
+        return false;
+    in.get();
+
+    const uint16_t probe = 1;
+    bool little_endian = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    bool swap = (scale < 0) != little_endian;
+
+    // rows are stored bottom to top
+    image = framebuffer(width, height);
+    auto row_bytes = std::streamsize(sizeof(float) * 3 * width);
+    for (int y = height - 1; y >= 0; y--) {
+        in.read(reinterpret_cast<char*>(image.row(y)), row_bytes);
+        if (swap) swap_float_bytes(image.row(y), size_t(width) * 3);
+    }
+    return bool(in);
+}
+
+// P3, P6 or pfm, picked from the header not the extension
+inline bool read_image(const std::string& path, framebuffer& image) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "could not open " << path << "\n";
+        return false;
+    }
+
+    std::string magic;
+    file >> magic;
+    bool ok = false;
+    if (magic == "P3" || magic == "P6") ok = read_ppm(file, magic == "P6", image);
+    else if (magic == "PF") ok = read_pfm(file, image);
+
+    if (!ok) std::cerr << path << " is not a P3/P6 ppm or pfm file this reader understands\n";
+    return ok;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include "framebuffer.h"
+#include "image_writer.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// writes an image while it's being rendered. the image is cut into bands of band_rows
+// rows (a row of tiles), renderers fill the bands' tiles in any order and a writer thread
+// puts every band out as soon as it and all bands before it in the file are complete.
+//
+// only window bands exist at a time, in a ring: a renderer that wants a band window or
+// more ahead of the one being written waits in begin_band until the writer is done with
+// it. so memory is window * band_rows rows whatever the image size, and a renderer going
+// much faster than the output (a pipe, a slow disk) gets held back instead of piling up
+// finished rows. bands are numbered in file order, band_rows_from() says where that is in
+// the image (bottom up for pfm)
+class ordered_band_writer {
+public:
+    ordered_band_writer(std::ostream& out, image_format format, int width, int height,
+                        int band_rows, int tiles_per_band, int window)
+        : out(out), writer(make_image_writer(format)), image_height(height),
+          band_rows(band_rows), tiles_per_band(tiles_per_band),
+          bands(std::max(1, std::min(window, band_count()))) {
+        for (auto& b : bands) {
+            b.rows = framebuffer(width, band_rows);
+            b.tiles_left = tiles_per_band;
+        }
+        writer->begin(out, width, height);
+        worker = std::thread([this] { run(); });
+    }
+
+    ~ordered_band_writer() { finish(); }
+
+    ordered_band_writer(const ordered_band_writer&) = delete;
+    ordered_band_writer& operator=(const ordered_band_writer&) = delete;
+
+    int band_count() const { return (image_height + band_rows - 1) / band_rows; }
+
+    // first image row of band k (file order), its rows are y0 .. y0 + band_rows - 1 but
+    // never past the image
+    int band_rows_from(int k) const {
+        return (writer->bottom_up() ? band_count() - 1 - k : k) * band_rows;
+    }
+
+    // the rows of band k to render into, image row band_rows_from(k) + i is row i. waits
+    // while band k is window or more bands ahead of the writer
+    framebuffer& begin_band(int k) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return k < next_band + int(bands.size()); });
+        return bands[size_t(k) % bands.size()].rows;
+    }
+
+    // one more tile of band k is done, the last one hands the band to the writer
+    void tile_done(int k) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--bands[size_t(k) % bands.size()].tiles_left == 0) changed.notify_all();
+    }
+
+    // waits until every band is written (they all have to be handed in), false if the
+    // output failed somewhere
+    bool finish() {
+        if (worker.joinable()) {
+            worker.join();
+            writer->end(out);
+            out.flush();
+        }
+        return bool(out);
+    }
+
+private:
+    struct band {
+        framebuffer rows;
+        int tiles_left = 0;
+    };
+
+    std::ostream& out;
+    std::unique_ptr<image_writer> writer;
+    int image_height;
+    int band_rows;
+    int tiles_per_band;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<band> bands; // ring, band k lives in bands[k % size]
+    int next_band = 0;       // the one the writer waits for or writes
+    std::thread worker;      // last, it starts running in the constructor
+
+    void run() {
+        for (int k = 0; k < band_count(); k++) {
+            band* b;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                b = &bands[size_t(k) % bands.size()];
+                changed.wait(lock, [&] { return b->tiles_left == 0; });
+            }
+
+            // the band's tiles are done and nobody touches it until next_band moves on
+            int y0 = band_rows_from(k);
+            int rows = std::min(band_rows, image_height - y0);
+            for (int i = 0; i < rows; i++)
+                writer->write_row(out, b->rows.row(writer->bottom_up() ? rows - 1 - i : i));
+            b->rows.clear(); // skipped tiles (a cancelled render) come out black
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                b->tiles_left = tiles_per_band;
+                next_band++;
+            }
+            changed.notify_all();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// output formats the renderer can write
+//   ppm_ascii - the original P3 text ppm, one line per pixel
+//   ppm       - binary P6 ppm, same image but written as raw bytes
+//   png       - 8 bit rgb png (stored deflate, no zlib needed)
+//   pfm       - portable float map, keeps the linear float values for hdr work
+enum class image_format { ppm_ascii, ppm, png, pfm };
+
+// writers take the image a row at a time, in the order the file stores them (bottom_up()
+// rows first for pfm), so an image can go out while it's still being rendered
+// (image_stream.h) and none of them needs a second copy of the whole image
+class image_writer {
+public:
+    virtual ~image_writer() = default;
+
+    virtual void begin(std::ostream& out, int width, int height) = 0;
+    // width linear rgb pixels, 3 floats each
+    virtual void write_row(std::ostream& out, const float* row) = 0;
+    virtual void end(std::ostream&) {}
+
+    // true if the file starts with the bottom row
+    virtual bool bottom_up() const { return false; }
+
+    void write(std::ostream& out, const framebuffer& image) {
+        begin(out, image.width(), image.height());
+        for (int i = 0; i < image.height(); i++) {
+            int y = bottom_up() ? image.height() - 1 - i : i;
+            write_row(out, image.row(y));
+            image.release_rows(y, y + 1); // only does something for out of core images
+        }
+        end(out);
+    }
+};
+
+class ppm_ascii_writer : public image_writer {
+public:
+    void begin(std::ostream& out, int width, int height) override {
+        out << "P3\n" << width << ' ' << height << "\n255\n";
+        row_width = width;
+    }
+
+    void write_row(std::ostream& out, const float* row) override {
+        for (int x = 0; x < row_width; x++)
+            write_color(out, color(row[3 * x], row[3 * x + 1], row[3 * x + 2]));
+    }
+
+private:
+    int row_width = 0;
+};
+
+// gamma corrected 8 bit values of width pixels, shared by the ppm and png writers
+inline void quantize_row(const float* src, int width, unsigned char* dest) {
+    for (int i = 0; i < width * 3; i++)
+        dest[i] = (unsigned char)color_to_byte(src[i]);
+}
+
+class ppm_binary_writer : public image_writer {
+public:
+    void begin(std::ostream& out, int width, int height) override {
+        out << "P6\n" << width << ' ' << height << "\n255\n";
+        row_width = width;
+        bytes.resize(size_t(width) * 3);
+    }
+
+    void write_row(std::ostream& out, const float* row) override {
+        quantize_row(row, row_width, bytes.data());
+        out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+    }
+
+private:
+    int row_width = 0;
+    std::vector<unsigned char> bytes; // one row
+};
+
+// pfm stores rows bottom to top and the sign of the scale gives the byte order,
+// the floats go out straight from the framebuffer without any conversion
+class pfm_writer : public image_writer {
+public:
+    void begin(std::ostream& out, int width, int height) override {
+        const uint16_t probe = 1;
+        bool little_endian = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+
+        out << "PF\n" << width << ' ' << height << '\n'
+            << (little_endian ? "-1.0" : "1.0") << '\n';
+        row_bytes = std::streamsize(sizeof(float) * 3 * width);
+    }
+
+    void write_row(std::ostream& out, const float* row) override {
+        out.write(reinterpret_cast<const char*>(row), row_bytes);
+    }
+
+    bool bottom_up() const override { return true; }
+
+private:
+    std::streamsize row_bytes = 0;
+};
+
+// minimal png encoder, the image data goes into uncompressed (stored) deflate blocks
+// so the file is about as big as a P6 ppm but any viewer can open it. the size of
+// everything is known up front, so rows go out as they come: every stored block (up to
+// 65535 bytes of rows) is an IDAT chunk of its own, the zlib stream just continues from
+// one chunk to the next. that also keeps chunks under png's 2^31 byte limit for huge images
+class png_writer : public image_writer {
+public:
+    void begin(std::ostream& out, int width, int height) override {
+        static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+        out.write(reinterpret_cast<const char*>(signature), 8);
+
+        std::vector<unsigned char> header;
+        put_u32(header, uint32_t(width));
+        put_u32(header, uint32_t(height));
+        header.push_back(8); // bit depth
+        header.push_back(2); // color type rgb
+        header.push_back(0); // compression
+        header.push_back(0); // filter
+        header.push_back(0); // no interlace
+        write_chunk(out, "IHDR", header);
+
+        // every row starts with a filter type byte (0 = none)
+        row.resize(size_t(width) * 3 + 1);
+        row[0] = 0;
+        raw_total = uint64_t(row.size()) * uint64_t(height);
+        raw_written = 0;
+        adler_a = 1;
+        adler_b = 0;
+        block.clear();
+    }
+
+    void write_row(std::ostream& out, const float* pixels) override {
+        quantize_row(pixels, int((row.size() - 1) / 3), row.data() + 1);
+        size_t pos = 0;
+        while (pos < row.size()) {
+            size_t len = std::min(row.size() - pos, block_limit - block.size());
+            update_adler(row.data() + pos, len);
+            block.insert(block.end(), row.begin() + pos, row.begin() + pos + len);
+            pos += len;
+            if (block.size() == block_limit || raw_written + block.size() == raw_total)
+                flush_block(out);
+        }
+    }
+
+    void end(std::ostream& out) override {
+        write_chunk(out, "IEND", {});
+    }
+
+private:
+    static constexpr size_t block_limit = 65535; // most a stored deflate block can hold
+
+    std::vector<unsigned char> row;   // filter byte + quantized pixels
+    std::vector<unsigned char> block; // rows of the stored block being filled
+    uint64_t raw_total = 0, raw_written = 0;
+    uint32_t adler_a = 1, adler_b = 0;
+
+    // adler32, with the modulo only every 5552 bytes (the most that can't overflow)
+    void update_adler(const unsigned char* data, size_t size) {
+        while (size > 0) {
+            size_t n = std::min<size_t>(size, 5552);
+            for (size_t i = 0; i < n; i++) {
+                adler_a += data[i];
+                adler_b += adler_a;
+            }
+            adler_a %= 65521;
+            adler_b %= 65521;
+            data += n;
+            size -= n;
+        }
+    }
+
+    // one IDAT chunk: the zlib header before the first block, the checksum after the last
+    void flush_block(std::ostream& out) {
+        bool first = raw_written == 0;
+        size_t len = block.size();
+        raw_written += len;
+        bool last = raw_written == raw_total;
+
+        std::vector<unsigned char> data;
+        data.reserve(len + 11);
+        if (first) {
+            data.push_back(0x78);
+            data.push_back(0x01);
+        }
+        data.push_back(last ? 1 : 0);
+        data.push_back((unsigned char)(len & 0xff));
+        data.push_back((unsigned char)(len >> 8));
+        data.push_back((unsigned char)(~len & 0xff));
+        data.push_back((unsigned char)((~len >> 8) & 0xff));
+        data.insert(data.end(), block.begin(), block.end());
+        if (last) put_u32(data, (adler_b << 16) | adler_a);
+        write_chunk(out, "IDAT", data);
+        block.clear();
+    }
+
+    static void put_u32(std::vector<unsigned char>& buf, uint32_t v) {
+        buf.push_back((unsigned char)(v >> 24));
+        buf.push_back((unsigned char)(v >> 16));
+        buf.push_back((unsigned char)(v >> 8));
+        buf.push_back((unsigned char)v);
+    }
+
+    static uint32_t crc32(const char type[4], const std::vector<unsigned char>& data) {
+        static const auto table = [] {
+            std::vector<uint32_t> t(256);
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                t[n] = c;
+            }
+            return t;
+        }();
+
+        uint32_t c = 0xffffffffu;
+        for (int i = 0; i < 4; i++)
+            c = table[(c ^ (unsigned char)type[i]) & 0xff] ^ (c >> 8);
+        for (unsigned char b : data)
+            c = table[(c ^ b) & 0xff] ^ (c >> 8);
+        return c ^ 0xffffffffu;
+    }
+
+    static void write_chunk(std::ostream& out, const char type[4], const std::vector<unsigned char>& data) {
+        std::vector<unsigned char> length, crc;
+        put_u32(length, uint32_t(data.size()));
+        put_u32(crc, crc32(type, data));
+
+        out.write(reinterpret_cast<const char*>(length.data()), 4);
+        out.write(type, 4);
+        out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+        out.write(reinterpret_cast<const char*>(crc.data()), 4);
+    }
+};
+
+inline std::unique_ptr<image_writer> make_image_writer(image_format format) {
+    switch (format) {
+        case image_format::ppm_ascii: return std::make_unique<ppm_ascii_writer>();
+        case image_format::png:       return std::make_unique<png_writer>();
+        case image_format::pfm:       return std::make_unique<pfm_writer>();
+        case image_format::ppm:       break;
+    }
+    return std::make_unique<ppm_binary_writer>();
+}
+
+// picks the format from the file extension, anything unknown gets the fallback
+inline image_format image_format_from_path(const std::string& path, image_format fallback) {
+    auto dot = path.find_last_of('.');
+    if (dot == std::string::npos) return fallback;
+    std::string ext = path.substr(dot + 1);
+    if (ext == "png") return image_format::png;
+    if (ext == "pfm") return image_format::pfm;
+    if (ext == "ppm") return image_format::ppm;
+    return fallback;
+}
+
+// name used on the command line, "p3" / "ppm" / "png" / "pfm"
+inline bool image_format_from_name(const std::string& name, image_format& format) {
+    if (name == "p3")  { format = image_format::ppm_ascii; return true; }
+    if (name == "ppm" || name == "p6") { format = image_format::ppm; return true; }
+    if (name == "png") { format = image_format::png; return true; }
+    if (name == "pfm") { format = image_format::pfm; return true; }
+    return false;
+}
+
+// stdout for an empty path or "-", otherwise file is opened (created/overwritten) and
+// returned, null if that fails
+inline std::ostream* open_image_output(const std::string& path, std::ofstream& file) {
+    if (path.empty() || path == "-") return &std::cout;
+    file.open(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "could not open " << path << " for writing\n";
+        return nullptr;
+    }
+    return &file;
+}
+
+// empty path or "-" means stdout, otherwise the file is created/overwritten
+inline bool write_image(const framebuffer& image, const std::string& path, image_format format) {
+    std::ofstream file;
+    std::ostream* out = open_image_output(path, file);
+    if (!out) return false;
+
+    make_image_writer(format)->write(*out, image);
+    out->flush();
+    return bool(*out);
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include "rtweekend.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "image_reader.h"
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+// compares two renders of the same scene, e.g. the float build against the double build:
+//   g++ -std=c++17 -O2 -pthread -o raytracer main.cpp
+//   g++ -std=c++17 -O2 -pthread -DRT_FLOAT -o raytracer_float main.cpp
+//   g++ -std=c++17 -O2 -o imgdiff imgdiff.cpp
+//   ./raytracer -o double.pfm && ./raytracer_float -o float.pfm
+//   ./imgdiff double.pfm float.pfm -o diff.pfm
+//
+// linear errors are on the raw values, psnr is on the gamma corrected [0, 1] values a
+// viewer shows, and "8 bit pixels" counts pixels whose ppm/png output would change
+
+static void print_usage(const char* program) {
+    std::fprintf(stderr, "usage: %s reference test [-o diff_image]\n"
+                         "  images are P3/P6 ppm or pfm, the diff image gets |reference - test| per channel\n",
+                 program);
+}
+
+int main(int argc, char* argv[]) {
+    std::string paths[2];
+    std::string diff_path;
+    int path_count = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            diff_path = argv[++i];
+        } else if (path_count < 2 && arg[0] != '-') {
+            paths[path_count++] = arg;
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (path_count != 2) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    framebuffer reference, test;
+    if (!read_image(paths[0], reference) || !read_image(paths[1], test)) return 2;
+    if (reference.width() != test.width() || reference.height() != test.height()) {
+        std::fprintf(stderr, "sizes differ: %dx%d vs %dx%d\n",
+                     reference.width(), reference.height(), test.width(), test.height());
+        return 2;
+    }
+
+    int width = reference.width(), height = reference.height();
+    size_t values = size_t(width) * height * 3;
+    framebuffer diff(width, height);
+
+    double abs_sum = 0, squared_sum = 0, max_abs = 0, reference_sum = 0;
+    double gamma_squared_sum = 0;
+    for (size_t i = 0; i < values; i++) {
+        double a = reference.data()[i], b = test.data()[i];
+        double d = std::fabs(a - b);
+        abs_sum += d;
+        squared_sum += d * d;
+        max_abs = std::max(max_abs, d);
+        reference_sum += std::fabs(a);
+
+        double g = std::min(1.0, linear_to_gamma(a)) - std::min(1.0, linear_to_gamma(b));
+        gamma_squared_sum += g * g;
+
+        diff.data()[i] = float(d);
+    }
+
+    size_t changed_pixels = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            color a = reference.get(x, y), b = test.get(x, y);
+            for (int c = 0; c < 3; c++) {
+                if (color_to_byte(a[c]) != color_to_byte(b[c])) {
+                    changed_pixels++;
+                    break;
+                }
+            }
+        }
+    }
+
+    double gamma_mse = gamma_squared_sum / values;
+    double psnr = gamma_mse > 0 ? 10 * std::log10(1 / gamma_mse) : INFINITY;
+
+    std::printf("%s vs %s, %dx%d\n", paths[0].c_str(), paths[1].c_str(), width, height);
+    std::printf("  mean abs error      %.6g\n", abs_sum / values);
+    std::printf("  relative mean error %.6g\n", reference_sum > 0 ? abs_sum / reference_sum : 0.0);
+    std::printf("  max abs error       %.6g\n", max_abs);
+    std::printf("  rmse                %.6g\n", std::sqrt(squared_sum / values));
+    std::printf("  psnr (gamma)        %.2f dB\n", psnr);
+    std::printf("  8 bit pixels        %zu of %zu differ (%.3f%%)\n", changed_pixels,
+                size_t(width) * height, 100.0 * changed_pixels / (size_t(width) * height));
+
+    if (!diff_path.empty())
+        return write_image(diff, diff_path, image_format_from_path(diff_path, image_format::pfm)) ? 0 : 2;
+    return 0;
+}
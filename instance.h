@@ -0,0 +1,255 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// affine transform p -> m * p + t as a 3x4 matrix, the last column is the translation
+struct affine_transform {
+    real m[3][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+
+    static affine_transform translation(const vec3& offset) {
+        affine_transform a;
+        for (int i = 0; i < 3; i++) a.m[i][3] = offset[i];
+        return a;
+    }
+
+    static affine_transform scaling(const vec3& factors) {
+        affine_transform a;
+        for (int i = 0; i < 3; i++) a.m[i][i] = factors[i];
+        return a;
+    }
+
+    // counterclockwise by degrees around axis 0, 1 or 2 (x, y, z) looking down the axis
+    static affine_transform rotation(int axis, double degrees) {
+        affine_transform a;
+        int i = (axis + 1) % 3, j = (axis + 2) % 3;
+        real c = real(std::cos(degrees_to_radians(degrees)));
+        real s = real(std::sin(degrees_to_radians(degrees)));
+        a.m[i][i] = c;  a.m[i][j] = -s;
+        a.m[j][i] = s;  a.m[j][j] = c;
+        return a;
+    }
+
+    point3 apply_point(const point3& p) const {
+        return point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                      m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                      m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    // normals go through the inverse transpose of the transform the points went through,
+    // called on that inverse it's just the transpose
+    vec3 apply_inverse_to_normal(const vec3& n) const {
+        return vec3(m[0][0] * n[0] + m[1][0] * n[1] + m[2][0] * n[2],
+                    m[0][1] * n[0] + m[1][1] * n[1] + m[2][1] * n[2],
+                    m[0][2] * n[0] + m[1][2] * n[1] + m[2][2] * n[2]);
+    }
+
+    // bound on the error of apply_point(p) for a p that is off by up to p_error already
+    // (pbrt 3.9.6): the old error grows with the matrix, plus the roundings of this product
+    vec3 point_error(const point3& p, const vec3& p_error) const {
+        vec3 e;
+        for (int i = 0; i < 3; i++) {
+            real carried = std::fabs(m[i][0]) * p_error[0] + std::fabs(m[i][1]) * p_error[1]
+                         + std::fabs(m[i][2]) * p_error[2];
+            real magnitude = std::fabs(m[i][0] * p[0]) + std::fabs(m[i][1] * p[1])
+                           + std::fabs(m[i][2] * p[2]) + std::fabs(m[i][3]);
+            e[i] = (1 + rounding_error(3)) * carried + rounding_error(3) * magnitude;
+        }
+        return e;
+    }
+
+    // first b, then this
+    affine_transform operator*(const affine_transform& b) const {
+        affine_transform a;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                a.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+            }
+            a.m[i][3] += m[i][3];
+        }
+        return a;
+    }
+
+    affine_transform inverse() const {
+        // 3x3 part by cofactors, then the translation moved back through it
+        real c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        real c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        real c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        real inv_det = 1 / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+        affine_transform a;
+        a.m[0][0] = c00 * inv_det;
+        a.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        a.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        a.m[1][0] = c01 * inv_det;
+        a.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        a.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        a.m[2][0] = c02 * inv_det;
+        a.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        a.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+        for (int i = 0; i < 3; i++)
+            a.m[i][3] = -(a.m[i][0] * m[0][3] + a.m[i][1] * m[1][3] + a.m[i][2] * m[2][3]);
+        return a;
+    }
+
+    // box around the transformed corners of box
+    aabb apply_box(const aabb& box) const {
+        aabb result;
+        for (int corner = 0; corner < 8; corner++) {
+            point3 p((corner & 1 ? box.x.max : box.x.min), (corner & 2 ? box.y.max : box.y.min),
+                     (corner & 4 ? box.z.max : box.z.min));
+            point3 q = apply_point(p);
+            result = aabb(result, aabb(q, q));
+        }
+        return result;
+    }
+};
+
+// the ray in the object's own space. the direction isn't normalized again, so a distance t
+// along it is the same point as t along the world ray and hit_t needs no conversion
+inline ray object_space_ray(const affine_transform& world_to_object, const ray& r) {
+    return ray(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()));
+}
+
+// surface info of a hit found in object space: the object fills it in for the object space
+// ray, then point, error bound and normal get moved out into the world
+inline void compute_instance_surface(const affine_transform& world_to_object, const ray& r, hit_record& rec) {
+    rec.hit_object = rec.inner_object;
+    rec.hit_object->compute_surface(object_space_ray(world_to_object, r), rec);
+
+    // a ray spawned from the point gets moved back into object space by the next hit test,
+    // which rounds again: that error (in object space) is added before going out, or the
+    // offset of spawn_ray can fall short and the ray hits the surface it's leaving
+    affine_transform object_to_world = world_to_object.inverse();
+    point3 local_point = rec.hit_point;
+    rec.hit_point = object_to_world.apply_point(local_point);
+    vec3 back_error = world_to_object.point_error(rec.hit_point, vec3(0, 0, 0));
+    rec.point_error = object_to_world.point_error(local_point, rec.point_error + back_error);
+
+    // the object flipped its normal to face the ray, transforming keeps that (it's the
+    // same ray) so only the length has to be fixed
+    rec.surface_normal = unit_vector(world_to_object.apply_inverse_to_normal(rec.surface_normal));
+}
+
+// one copy of shared geometry somewhere else in the scene. the geometry (a mesh, a bvh of
+// spheres, ...) exists once and every instance only holds a pointer and a transform, the
+// ray is moved into the geometry's space instead of the geometry into the world
+//
+// the geometry can't be an instance or instance_set itself, there is one level of it
+class instance : public hittable {
+public:
+    instance(shared_ptr<hittable> object, const affine_transform& object_to_world)
+        : object(object), world_to_object(object_to_world.inverse()),
+          bbox(object_to_world.apply_box(object->bounding_box())) {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!object->hit(object_space_ray(world_to_object, r), ray_t, rec)) return false;
+        rec.inner_object = rec.hit_object;
+        rec.hit_object = this;
+        return true;
+    }
+
+    bool hit_any(const ray& r, interval ray_t) const override {
+        return object->hit_any(object_space_ray(world_to_object, r), ray_t);
+    }
+
+    void compute_surface(const ray& r, hit_record& rec) const override {
+        compute_instance_surface(world_to_object, r, rec);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    shared_ptr<hittable> object;
+    affine_transform world_to_object;
+    aabb bbox;
+};
+
+// many instances of a few shared objects (prototypes) as one hittable, the two level
+// acceleration structure: a bvh over the instances' world boxes on top, and below every
+// prototype's own structure (a triangle_mesh's bvh, a bvh_node, ...) walked with the ray
+// moved into its space
+//
+// an instance is just the prototype index and one transform in an array, no heap object
+// and no shared_ptr each, so a million instances cost about 140 bytes apiece (75 in the
+// float build) with the top level bvh, plus one copy of every prototype
+class instance_set : public hittable {
+public:
+    uint32_t add_prototype(shared_ptr<hittable> object) {
+        prototypes.push_back(object);
+        return uint32_t(prototypes.size() - 1);
+    }
+
+    // call build() after the last instance is added
+    void add(uint32_t prototype, const affine_transform& object_to_world) {
+        instances.push_back(instance_record{ object_to_world.inverse(), prototype });
+    }
+
+    void build() {
+        std::vector<aabb> boxes;
+        boxes.reserve(instances.size());
+        for (const auto& inst : instances)
+            boxes.push_back(inst.world_to_object.inverse().apply_box(prototypes[inst.prototype]->bounding_box()));
+
+        std::vector<instance_record> ordered;
+        ordered.reserve(instances.size());
+        for (uint32_t index : tree.build(boxes))
+            ordered.push_back(instances[index]);
+        instances = std::move(ordered);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return tree.traverse(r, ray_t, [&](uint32_t i, interval& t) {
+            const instance_record& inst = instances[i];
+            if (!prototypes[inst.prototype]->hit(object_space_ray(inst.world_to_object, r), t, rec)) return false;
+            rec.inner_object = rec.hit_object;
+            rec.instance_index = i;
+            rec.hit_object = this;
+            t.max = rec.hit_t;
+            return true;
+        });
+    }
+
+    bool hit_any(const ray& r, interval ray_t) const override {
+        return tree.traverse_any(r, ray_t, [&](uint32_t i, interval& t) {
+            const instance_record& inst = instances[i];
+            return prototypes[inst.prototype]->hit_any(object_space_ray(inst.world_to_object, r), t);
+        });
+    }
+
+    void compute_surface(const ray& r, hit_record& rec) const override {
+        compute_instance_surface(instances[rec.instance_index].world_to_object, r, rec);
+    }
+
+    aabb bounding_box() const override { return tree.bounding_box(); }
+
+    size_t size() const { return instances.size(); }
+    size_t prototype_count() const { return prototypes.size(); }
+    size_t node_count() const { return tree.node_count(); }
+
+private:
+    // only the inverse is kept, it's what every hit test needs. the forward transform is
+    // worked out again for the one closest hit that gets compute_surface
+    struct instance_record {
+        affine_transform world_to_object;
+        uint32_t prototype;
+    };
+
+    std::vector<shared_ptr<hittable>> prototypes;
+    std::vector<instance_record> instances; // leaf order after build()
+    bvh_tree tree;
+};
+
+#endif
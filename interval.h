@@ -1,31 +1,42 @@
 #ifndef INTERVAL_H
 #define INTERVAL_H
 #include "rtweekend.h"
+#include "real.h"
 class interval {
   public:
-    double min, max;
+    real min, max;
 
     interval() : min(+infinity), max(-infinity) {} // Default interval is empty
 
-    interval(double min, double max) : min(min), max(max) {}
+    interval(real min, real max) : min(min), max(max) {}
 
-    double size() const {
+    // tightest interval enclosing both a and b
+    interval(const interval& a, const interval& b)
+        : min(a.min <= b.min ? a.min : b.min), max(a.max >= b.max ? a.max : b.max) {}
+
+    real size() const {
         return max - min;
     }
 
-    bool contains(double x) const {
+    bool contains(real x) const {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const {
+    bool surrounds(real x) const {
         return min < x && x < max;
     }
-    double clamp(double x) const {
+    real clamp(real x) const {
         if (x < min) return min;
         if (x > max) return max;
         return x;
     }
 
+    // grows the interval by delta in total (half on each side)
+    interval expand(real delta) const {
+        auto padding = delta / 2;
+        return interval(min - padding, max + padding);
+    }
+
     static const interval empty, universe;
 };
 
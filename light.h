@@ -0,0 +1,171 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// an emissive sphere, what next event estimation aims shadow rays at
+struct sphere_light {
+    point3 center;
+    real radius;
+    uint32_t material_id;
+    color radiance;
+};
+
+// a direction towards a light, picked by light_list::sample
+struct light_sample {
+    vec3 direction;  // unit length
+    real distance;   // to the light's surface along direction
+    real pdf;        // per solid angle, times the chance of picking this light
+    color radiance;
+};
+
+// where a path last scattered and the pdf scatter picked its direction with, so the light
+// the next hit finds can be weighed against sampling that light from there.
+// pdf 0: nothing to weigh against (camera ray, mirror or glass bounce, no light sampling)
+struct path_vertex {
+    point3 point;
+    real pdf = 0;
+};
+
+// power heuristic with beta 2 (Veach 1997), weight of the strategy with pdf f when the
+// other one would have picked the same direction with pdf g
+inline real power_heuristic(real f, real g) {
+    real ff = f * f, gg = g * g;
+    return ff / (ff + gg);
+}
+
+// the lights of a scene for next event estimation: at a diffuse hit one light is picked
+// (brighter and bigger ones more often) and a shadow ray is sent towards it, instead of
+// waiting for a bounce to run into the light by chance. a small light that scattered rays
+// almost never find gets about as cheap to render as the sky
+//
+// only spheres are sampled, other emissive objects (a mesh with a light material) still
+// glow but are only found by bouncing into them
+class light_list {
+public:
+    void add(const point3& center, real radius, uint32_t material_id, const color& radiance) {
+        // power of a sphere light goes with radiance times area
+        double power = luminance(radiance) * double(radius) * radius;
+        if (!(power > 0)) return;
+        lights.push_back(sphere_light{ center, radius, material_id, radiance });
+        total_power += power;
+        cdf.push_back(total_power);
+    }
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+    const sphere_light& operator[](size_t i) const { return lights[i]; }
+
+    // a scene without lights, for render calls that don't pass any
+    static const light_list& none() {
+        static const light_list empty_list;
+        return empty_list;
+    }
+
+    // picks a light and a direction in the cone it covers seen from p, uniform over that
+    // cone so every direction that can reach the sphere is equally likely. false if p is
+    // inside the light. always draws three random numbers
+    bool sample(const point3& p, light_sample& s) const {
+        double pick = random_double();
+        double u1, u2;
+        thread_sampler().next_2d(u1, u2);
+
+        size_t index = size_t(std::upper_bound(cdf.begin(), cdf.end(), pick * total_power) - cdf.begin());
+        index = std::min(index, lights.size() - 1);
+        const sphere_light& light = lights[index];
+
+        vec3 to_center = light.center - p;
+        real d2 = to_center.length_squared();
+        real r2 = light.radius * light.radius;
+        if (d2 <= r2) return false;
+        real d = std::sqrt(d2);
+
+        // 1 - cos(theta_max) written so it doesn't cancel to 0 for small far lights
+        real sin2_max = r2 / d2;
+        real cone = sin2_max / (1 + std::sqrt(1 - sin2_max));
+
+        real one_minus_cos = real(u1) * cone;
+        real cos_theta = 1 - one_minus_cos;
+        real sin2_theta = one_minus_cos * (2 - one_minus_cos);
+        real sin_theta = std::sqrt(sin2_theta);
+        real phi = 2 * pi * real(u2);
+
+        vec3 w = to_center / d;
+        vec3 a, b;
+        orthonormal_basis(w, a, b);
+        s.direction = (std::cos(phi) * sin_theta) * a + (std::sin(phi) * sin_theta) * b + cos_theta * w;
+
+        // near side of the sphere along the direction
+        s.distance = d * cos_theta - std::sqrt(std::fmax(real(0), r2 - d2 * sin2_theta));
+        s.pdf = real(probability(index) / (2 * pi * cone));
+        s.radiance = light.radiance;
+        return true;
+    }
+
+    // pdf sample(p) would have given the direction from p to the hit in rec, 0 if the hit
+    // isn't on one of the lights. lights are found by material and distance from the
+    // center, a linear scan, scenes have a handful of lights
+    real pdf(const point3& p, const hit_record& rec) const {
+        for (size_t i = 0; i < lights.size(); i++) {
+            const sphere_light& light = lights[i];
+            if (light.material_id != rec.material_id) continue;
+            real r2 = light.radius * light.radius;
+            if (std::fabs((rec.hit_point - light.center).length_squared() - r2) > real(1e-3) * r2) continue;
+
+            real d2 = (light.center - p).length_squared();
+            if (d2 <= r2) return 0;
+            real sin2_max = r2 / d2;
+            real cone = sin2_max / (1 + std::sqrt(1 - sin2_max));
+            return real(probability(i) / (2 * pi * cone));
+        }
+        return 0;
+    }
+
+private:
+    std::vector<sphere_light> lights;
+    std::vector<double> cdf; // running sum of the lights' power
+    double total_power = 0;
+
+    double probability(size_t i) const {
+        return (cdf[i] - (i > 0 ? cdf[i - 1] : 0)) / total_power;
+    }
+
+    static double luminance(const color& c) {
+        return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+    }
+
+    // two unit vectors perpendicular to w and each other (Duff et al. 2017), no branch
+    // on which axis w is closest to
+    static void orthonormal_basis(const vec3& w, vec3& a, vec3& b) {
+        real sign = std::copysign(real(1), w.z());
+        real s = -1 / (sign + w.z());
+        real t = w.x() * w.y() * s;
+        a = vec3(1 + sign * w.x() * w.x() * s, sign * t, -sign * w.x());
+        b = vec3(t, sign + w.y() * w.y() * s, -w.y());
+    }
+};
+
+// the lights of a scene built from the virtual classes: the spheres in list with a
+// diffuse_light material. list has to hold the spheres themselves, not a bvh_node of them
+inline light_list find_lights(const hittable_list& list, const material_table& materials) {
+    light_list lights;
+    for (const auto& obj : list.objects) {
+        auto s = dynamic_cast<const sphere*>(obj.get());
+        if (!s) continue;
+        if (auto emitter = dynamic_cast<const diffuse_light*>(&materials[s->sphere_material()]))
+            lights.add(s->sphere_center(), s->sphere_radius(), s->sphere_material(), emitter->emission());
+    }
+    return lights;
+}
+
+#endif
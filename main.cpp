@@ -4,59 +4,303 @@
 #include "material.h"
 #include "sphere.h"
 #include "camera.h"
+#include "bvh.h"
+#include "image_writer.h"
+#include "scenes.h"
+#include "static_scene.h"
+#include "scene_file.h"
+#include "scene_cache.h"
+#include "animation.h"
+#include "render_server.h"
+#include "stats.h"
 
-int main() {
+#include <cstdlib>
+#include <string>
 
-    // hittable list contains all objects that are going to be in the way of ray and 
-    // it is inherited from the class hittable
-    // every object is some kind of math equation and solution with a ray and 
-    // that object gives us points in 3d space where we have to add color
+static void print_usage(const char* program) {
+    std::cerr << "usage: " << program << " [-o output] [-f p3|ppm|png|pfm] [--adaptive noise] [--spp-debug file]\n"
+              << "       [--integrator recursive|iterative|wavefront] [--static-dispatch] [--scene file [--write-cache file]]\n"
+              << "       [--stats file] [--processes n [--passes n] [--worker-timeout s]] [--spp n] [--checkpoint file] [--no-light-sampling]\n"
+              << "       [--denoise] [--albedo file] [--normal file] [--server | --server-socket path]\n"
+              << "       [--sampler independent|stratified|sobol|blue-noise] [--stream] [--framebuffer-dir dir]\n"
+              << "  -o           output file, stdout when missing or \"-\"\n"
+              << "  -f           output format, otherwise taken from the file extension (default ppm)\n"
+              << "  --adaptive   stop sampling a pixel once its noise is below this (e.g. 0.004)\n"
+              << "  --spp-debug  also write an image of the samples every pixel used\n"
+              << "  --integrator path tracer, iterative ends dim paths early (russian roulette),\n"
+              << "               wavefront traces iterative paths in batches sorted by material\n"
+              << "  --static-dispatch  render through std::variant objects instead of virtual calls\n"
+              << "  --scene      render a scene file (text, see scene_file.h, or a cache) instead of the built in one,\n"
+              << "               scenes with frames write one file per frame (-o frame_###.png)\n"
+              << "  --write-cache  compile the --scene file into a binary cache that loads instantly, no render\n"
+              << "  --stats      write ray, intersection and timing counters as json (needs -DRT_STATS)\n"
+              << "  --processes  render with this many worker processes instead of threads\n"
+              << "  --passes     with --processes, split every pixel's samples into this many rounds\n"
+              << "  --worker-timeout  seconds a worker gets for a tile before it counts as hung and is replaced\n"
+              << "               (default 10 times the slowest tile so far, at least 60)\n"
+              << "  --crash-worker  testing: the first worker dies when it gets its n-th tile\n"
+              << "  --hang-worker   testing: the first worker stops halfway through answering its n-th tile\n"
+              << "  --spp        samples per pixel instead of the scene's\n"
+              << "  --checkpoint render progressively into this file and resume from it if it exists\n"
+              << "  --checkpoint-interval  seconds between syncs of the checkpoint (default 60)\n"
+              << "  --no-light-sampling  find lights only by bouncing into them, no shadow rays\n"
+              << "  --denoise    filter the noise out after rendering, guided by albedo and normals (try --spp 16)\n"
+              << "  --albedo     also write the first hit albedo buffer\n"
+              << "  --normal     also write the first hit normal buffer\n"
+              << "  --sampler    where pixel, lens, bounce and light sample positions come from (sampler.h)\n"
+              << "  --stream     write rows of tiles as they finish instead of the whole image at the end,\n"
+              << "               so memory doesn't grow with the image size (not with --denoise and the like)\n"
+              << "  --framebuffer-dir  keep the framebuffer in a scratch file in this directory, not in memory\n"
+              << "  --server     keep running and render the jobs given on stdin, scenes stay loaded (render_server.h)\n"
+              << "  --server-socket  the same, jobs come over connections to a unix socket at this path\n";
+}
 
+int main(int argc, char* argv[]) {
 
-    hittable_list scene_objects;
+    std::string output_path;
+    std::string format_name;
+    std::string spp_debug_path;
+    double adaptive_noise = 0;
+    integrator path_integrator = integrator::recursive;
+    bool static_dispatch = false;
+    std::string scene_path;
+    std::string cache_path;
+    std::string stats_path;
+    int process_count = 0;
+    int sample_passes = 1;
+    int worker_crash_test = 0;
+    int worker_hang_test = 0;
+    double worker_timeout = 0;
+    int samples_per_pixel = 0;
+    std::string checkpoint_path;
+    double checkpoint_interval = 60;
+    bool light_sampling = true;
+    bool denoise = false;
+    std::string albedo_path;
+    std::string normal_path;
+    bool server = false;
+    sampler_kind sampler = sampler_kind::independent;
+    bool stream_output = false;
+    std::string framebuffer_directory;
+    std::string server_socket;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (arg == "-f" && i + 1 < argc) {
+            format_name = argv[++i];
+        } else if (arg == "--adaptive" && i + 1 < argc) {
+            adaptive_noise = std::atof(argv[++i]);
+        } else if (arg == "--spp-debug" && i + 1 < argc) {
+            spp_debug_path = argv[++i];
+        } else if (arg == "--scene" && i + 1 < argc) {
+            scene_path = argv[++i];
+        } else if (arg == "--write-cache" && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if (arg == "--processes" && i + 1 < argc) {
+            process_count = std::atoi(argv[++i]);
+        } else if (arg == "--passes" && i + 1 < argc) {
+            sample_passes = std::atoi(argv[++i]);
+        } else if (arg == "--crash-worker" && i + 1 < argc) {
+            worker_crash_test = std::atoi(argv[++i]);
+        } else if (arg == "--hang-worker" && i + 1 < argc) {
+            worker_hang_test = std::atoi(argv[++i]);
+        } else if (arg == "--worker-timeout" && i + 1 < argc) {
+            worker_timeout = std::atof(argv[++i]);
+        } else if (arg == "--spp" && i + 1 < argc) {
+            samples_per_pixel = std::atoi(argv[++i]);
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+        } else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+            checkpoint_interval = std::atof(argv[++i]);
+        } else if (arg == "--albedo" && i + 1 < argc) {
+            albedo_path = argv[++i];
+        } else if (arg == "--normal" && i + 1 < argc) {
+            normal_path = argv[++i];
+        } else if (arg == "--server-socket" && i + 1 < argc) {
+            server_socket = argv[++i];
+        } else if (arg == "--sampler" && i + 1 < argc) {
+            if (!sampler_kind_from_name(argv[++i], sampler)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--framebuffer-dir" && i + 1 < argc) {
+            framebuffer_directory = argv[++i];
+        } else if (arg == "--stream") {
+            stream_output = true;
+        } else if (arg == "--server") {
+            server = true;
+        } else if (arg == "--denoise") {
+            denoise = true;
+        } else if (arg == "--no-light-sampling") {
+            light_sampling = false;
+        } else if (arg == "--static-dispatch") {
+            static_dispatch = true;
+        } else if (arg == "--integrator" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "recursive") path_integrator = integrator::recursive;
+            else if (name == "iterative") path_integrator = integrator::iterative;
+            else if (name == "wavefront") path_integrator = integrator::wavefront;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    image_format output_format = image_format_from_path(output_path, image_format::ppm);
+    if (!format_name.empty() && !image_format_from_name(format_name, output_format)) {
+        std::cerr << "unknown format " << format_name << "\n";
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // scene files (and the server's) render through flat_scene, no virtual calls to begin with
+    if (static_dispatch && (!scene_path.empty() || server || !server_socket.empty())) {
+        std::cerr << "--static-dispatch is for the built in scene, scene files already render without virtual calls\n";
+        return 1;
+    }
+
+    if (!stats_path.empty() && !stats_enabled) {
+        std::cerr << "--stats needs a build with -DRT_STATS\n";
+        return 1;
+    }
+
+    // render settings from the command line, the same whatever the scene comes from
+    auto setup_camera = [&](camera& main_camera) {
+        // tiles are spread over every core, set thread_count = 1 for the old single threaded loop
+        main_camera.thread_count = 0;
+        main_camera.tile_size    = 16;
+
+        // or the tiles go to forked worker processes (distributed.h)
+        main_camera.process_count     = process_count;
+        main_camera.sample_passes     = sample_passes;
+        main_camera.worker_crash_test = worker_crash_test;
+        main_camera.worker_hang_test  = worker_hang_test;
+        main_camera.worker_timeout    = worker_timeout;
+
+        main_camera.output_path   = output_path;
+        main_camera.output_format = output_format;
+
+        // rows go out while the render is running, or the whole framebuffer lives in a file
+        main_camera.stream_output         = stream_output;
+        main_camera.framebuffer_directory = framebuffer_directory;
+
+        // adaptive sampling treats samples_per_pixel as the upper limit
+        if (adaptive_noise > 0) {
+            main_camera.adaptive_sampling = true;
+            main_camera.min_samples       = 16;
+            main_camera.noise_threshold   = adaptive_noise;
+        }
+        main_camera.spp_debug_path = spp_debug_path;
+
+        if (samples_per_pixel > 0) main_camera.samples_per_pixel = samples_per_pixel;
 
-    auto matte_ground = make_shared<lambertian>(color(0.05, 0.05, 0.05));
-    scene_objects.add(make_shared<sphere>(point3(0, -1000.5, 0), 1000, matte_ground));
+        // progressive with a checkpoint file, running it again adds samples up to the target
+        main_camera.checkpoint_path     = checkpoint_path;
+        main_camera.checkpoint_interval = checkpoint_interval;
 
-    auto refractive_center = make_shared<dielectric>(1.5);
-    scene_objects.add(make_shared<sphere>(point3(0, 1, 0), 1.0, refractive_center));
+        main_camera.path_integrator      = path_integrator;
+        main_camera.roulette_start_depth = 3;
+        main_camera.light_sampling       = light_sampling;
+        main_camera.sampler              = sampler;
 
-    auto reflective_purple = make_shared<metal>(color(0.6, 0.2, 0.9), 0.0);
-    scene_objects.add(make_shared<sphere>(point3(-2.5, 1.2, -1.5), 1.0, reflective_purple));
+        // denoising needs the albedo and normal buffers, they can be written out as well
+        main_camera.denoise     = denoise;
+        main_camera.albedo_path = albedo_path;
+        main_camera.normal_path = normal_path;
+    };
 
-    auto reflective_blue = make_shared<metal>(color(0.2, 0.8, 1.0), 0.0);
-    scene_objects.add(make_shared<sphere>(point3(2.5, 1.0, -1.0), 1.0, reflective_blue));
+    // long running: scenes and output files come with the jobs
+    if (server || !server_socket.empty()) {
+        render_server jobs;
+        jobs.setup = setup_camera;
+        return (server_socket.empty() ? jobs.serve_stream(0, 1) : jobs.serve_socket(server_socket)) ? 0 : 1;
+    }
 
-    auto floating_mirror = make_shared<metal>(color(0.95, 0.95, 0.95), 0.0);
-    scene_objects.add(make_shared<sphere>(point3(0, 3.2, 0.5), 0.7, floating_mirror));
+    // scene from a file: text gets parsed and its bvh built, a cache only gets mapped
+    if (!scene_path.empty()) {
+        scene_description description;
+        flat_scene file_scene;
+        if (flat_scene::is_cache(scene_path)) {
+            if (!file_scene.open_cache(scene_path)) return 1;
+        } else {
+            if (!load_scene_text(scene_path, description)) return 1;
+            // keyed values hold from frame 0 on, also for a single frame and the cache
+            apply_frame(description, 0);
+            file_scene.build(description);
+        }
 
-    auto small_glass_orb = make_shared<dielectric>(1.5);
-    scene_objects.add(make_shared<sphere>(point3(-2.5, 3.0, -1.5), 0.3, small_glass_orb));
+        if (!cache_path.empty()) {
+            if (!description.tracks.empty())
+                std::cerr << "note: the cache keeps the first frame only, animation is read from text scenes\n";
+            return file_scene.write_cache(cache_path) ? 0 : 1;
+        }
 
-    // There are different types of objects or same objects with differnet properties but they all share same space 
+        // animated scene: every frame in this process, -o is the pattern for the frame files
+        if (description.frame_count > 1) {
+            if (output_path.empty() || output_path == "-") {
+                std::cerr << "an animation needs -o with a file name pattern, e.g. frame_###.png\n";
+                return 1;
+            }
+            if (!stats_path.empty()) {
+                std::cerr << "--stats only works for single frame renders\n"; // counters restart every frame
+                return 1;
+            }
+            return render_animation(description, file_scene, output_path, output_format, setup_camera) ? 0 : 1;
+        }
+
+        camera main_camera;
+        file_scene.camera.apply(main_camera);
+        setup_camera(main_camera);
+        if (!main_camera.render(file_scene)) return 1;
+        if (!stats_path.empty() && !write_stats_json(stats_path, main_camera.last_render_seconds())) return 1;
+        return 0;
+    }
+    if (!cache_path.empty()) {
+        std::cerr << "--write-cache needs a --scene to compile\n";
+        return 1;
+    }
+
+    // hittable list contains all objects that are going to be in the way of ray and 
+    // it is inherited from the class hittable
+    hittable_list scene_objects;
+
+    // materials live in one table owned by the scene, spheres only keep an index into it
+    material_table scene_materials;
+
+    // the objects and camera settings themselves are in scenes.h
+    main_scene(scene_objects, scene_materials);
+
+    // static dispatch: same objects copied by value into variants, so the render loop makes
+    // no virtual calls (static_scene.h). it has its own bvh inside
+    static_scene fast_scene;
+    if (static_dispatch && !static_scene::from_virtual(scene_objects, scene_materials, fast_scene)) {
+        std::cerr << "scene has types static dispatch doesn't know\n";
+        return 1;
+    }
+
+    // emissive spheres get sampled directly, found while the list still holds the spheres
+    light_list scene_lights = find_lights(scene_objects, scene_materials);
+
+    // wrap everything in a bvh so a ray only tests objects whose boxes it actually passes through
+    scene_objects = hittable_list(make_shared<bvh_node>(scene_objects));
 
     // camera class defines a camera that is basically sending bunch of rays from single point but later on 
     // we make some changes because to simulate real life camera we don't use a point source (but in theory  we do)
     camera main_camera;
-    main_camera.aspect_ratio      = 16.0 / 9.0;
-    main_camera.image_width       = 600;
-    main_camera.samples_per_pixel = 100;
-    main_camera.max_depth         = 30;
-
-    //VFOV stands for vertical field of view 
-    // lookfrom is from where we are looking generally (0,0,0) but we can override it to change camera direction
-    
-
-    main_camera.vfov     = 40;
-    main_camera.lookfrom = point3(6, 5, -3);      
-    main_camera.lookat   = point3(0, 0, 0);       
-    main_camera.vup      = vec3(1, 0, 0); 
+    main_scene_camera(main_camera);
 
-    // vfov,lookfrom and lookat changes the places of camera not its properties 
-    // but defocus changes the properties of camera 
+    setup_camera(main_camera);
 
-    main_camera.defocus_angle = 0.3;
-    main_camera.focus_dist    = 8.0;
+    bool rendered = static_dispatch ? main_camera.render(fast_scene)
+                                    : main_camera.render(scene_objects, scene_materials, scene_lights);
+    if (!rendered) return 1;
 
-    main_camera.render(scene_objects);
+    if (!stats_path.empty() && !write_stats_json(stats_path, main_camera.last_render_seconds())) return 1;
 }
@@ -0,0 +1,137 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// memory mapping of a whole file (posix mmap). the pages are loaded by the os when they're
+// first touched, so "opening" a big file costs about the same as opening a small one and
+// the data never gets copied into our own buffers
+//
+// open() maps read only. open_writable() maps shared and writable: stores go straight to
+// the os page cache, so they survive the process getting killed, and sync() waits until
+// they're on disk
+class mapped_file {
+public:
+    mapped_file() {}
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    mapped_file(mapped_file&& other) noexcept { *this = std::move(other); }
+    mapped_file& operator=(mapped_file&& other) noexcept {
+        if (this != &other) {
+            close();
+            bytes = other.bytes;
+            byte_count = other.byte_count;
+            writable = other.writable;
+            other.bytes = nullptr;
+            other.byte_count = 0;
+            other.writable = false;
+        }
+        return *this;
+    }
+
+    bool open(const std::string& path) {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "could not open " << path << "\n";
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            std::cerr << "could not map " << path << " (empty or unreadable)\n";
+            ::close(fd);
+            return false;
+        }
+
+        void* p = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps its own reference to the file
+        if (p == MAP_FAILED) {
+            std::cerr << "could not map " << path << "\n";
+            return false;
+        }
+
+        bytes = static_cast<unsigned char*>(p);
+        byte_count = size_t(info.st_size);
+        return true;
+    }
+
+    // maps the file for writing, creating it if needed and growing or shrinking it to size
+    // bytes (new bytes read as zero). existing contents are kept
+    bool open_writable(const std::string& path, size_t size) {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            std::cerr << "could not open " << path << " for writing\n";
+            return false;
+        }
+        if (size == 0 || ftruncate(fd, off_t(size)) != 0) {
+            std::cerr << "could not resize " << path << "\n";
+            ::close(fd);
+            return false;
+        }
+
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            std::cerr << "could not map " << path << "\n";
+            return false;
+        }
+
+        bytes = static_cast<unsigned char*>(p);
+        byte_count = size;
+        writable = true;
+        return true;
+    }
+
+    // blocks until everything written through the mapping is on disk
+    bool sync() {
+        return !writable || msync(bytes, byte_count, MS_SYNC) == 0;
+    }
+
+    // done with bytes [offset, offset + length) for now: the memory pages that lie
+    // completely inside them are given back to the os. the data stays in the file and
+    // is loaded again when touched
+    void release(size_t offset, size_t length) const {
+        if (!bytes || length == 0) return;
+        size_t page = size_t(sysconf(_SC_PAGESIZE));
+        uintptr_t begin = reinterpret_cast<uintptr_t>(bytes + offset);
+        uintptr_t end = begin + length;
+        begin = (begin + page - 1) / page * page;
+        end = end / page * page;
+        if (end > begin) madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+    }
+
+    void close() {
+        if (bytes) munmap(bytes, byte_count);
+        bytes = nullptr;
+        byte_count = 0;
+        writable = false;
+    }
+
+    const unsigned char* data() const { return bytes; }
+    unsigned char* writable_data() { return writable ? bytes : nullptr; }
+    size_t size() const { return byte_count; }
+    bool is_open() const { return bytes != nullptr; }
+
+private:
+    unsigned char* bytes = nullptr;
+    size_t byte_count = 0;
+    bool writable = false;
+};
+
+#endif
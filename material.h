@@ -3,6 +3,13 @@
 
 #include "color.h"
 #include "hittable.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 
 // base material class - every material should define its scatter behavior
 class material {
@@ -15,6 +22,34 @@ public:
     ) const {
         return false;
     }
+
+    // light the surface gives off by itself towards the ray, black for everything but lights
+    virtual color emitted(const ray& incoming_ray, const hit_record& rec) const {
+        return color(0, 0, 0);
+    }
+
+    // for sampling lights: brdf times cosine for light arriving from dir, and the pdf (per
+    // solid angle) that scatter picks dir with. pdf = 0 means scatter can't be evaluated
+    // for a given direction (mirrors, glass), such hits don't sample lights and only see
+    // them by bouncing into them
+    virtual color evaluate(const ray& incoming_ray, const hit_record& rec, const vec3& dir, real& pdf) const {
+        pdf = 0;
+        return color(0, 0, 0);
+    }
+
+    // whether evaluate can give a pdf at all, false if it always says 0. hits on such
+    // materials skip light sampling without picking a light first
+    virtual bool has_pdf() const { return false; }
+
+    // color of the surface itself for the denoiser's albedo buffer (denoise.h), white for
+    // materials that don't tint what they reflect or let through
+    virtual color base_color(const hit_record& rec) const {
+        return color(1, 1, 1);
+    }
+
+    // a perfect mirror: scatter always sends the ray the same way, so the denoiser's
+    // features show what's in it instead of the mirror itself
+    virtual bool is_mirror() const { return false; }
 };
 
 // matte surface - light scatters randomly
@@ -24,6 +59,8 @@ public:
 
     bool scatter(const ray& incoming_ray, const hit_record& rec, color& attenuation, ray& scattered_ray)
     const override {
+        RT_STAT_INC(lambertian_scatters);
+
         // new direction after scattering
         vec3 scatter_dir = rec.surface_normal + random_unit_vector();
 
@@ -31,11 +68,27 @@ public:
         if (scatter_dir.near_zero())
             scatter_dir = rec.surface_normal;
 
-        scattered_ray = ray(rec.hit_point, scatter_dir);
+        scattered_ray = spawn_ray(rec, scatter_dir);
         attenuation = albedo; // color of the surface
         return true;
     }
 
+    // normal + random unit vector is cosine distributed, pdf = cos / pi, the brdf is
+    // albedo / pi (so attenuation = brdf * cos / pdf is the albedo scatter returns)
+    color evaluate(const ray& incoming_ray, const hit_record& rec, const vec3& dir, real& pdf) const override {
+        real cosine = dot(rec.surface_normal, dir) / dir.length();
+        if (cosine <= 0) {
+            pdf = 0;
+            return color(0, 0, 0);
+        }
+        pdf = cosine / pi;
+        return albedo * cosine / pi;
+    }
+
+    bool has_pdf() const override { return true; }
+
+    color base_color(const hit_record& rec) const override { return albedo; }
+
 private:
     color albedo; // surface color
 };
@@ -43,44 +96,51 @@ private:
 // metallic surface - reflects light with optional fuzziness
 class metal : public material {
 public:
-    metal(const color& texture_color, double fuzz_factor)
+    metal(const color& texture_color, real fuzz_factor)
         : albedo(texture_color), fuzz(fuzz_factor < 1 ? fuzz_factor : 1) {}
 
     bool scatter(const ray& incoming_ray, const hit_record& rec, color& attenuation, ray& scattered_ray)
     const override {
+        RT_STAT_INC(metal_scatters);
+
         // get reflected direction with fuzz
         vec3 reflected_dir = reflect(unit_vector(incoming_ray.direction()), rec.surface_normal);
         reflected_dir += fuzz * random_unit_vector();
 
-        scattered_ray = ray(rec.hit_point, reflected_dir);
+        scattered_ray = spawn_ray(rec, reflected_dir);
         attenuation = albedo;
 
         // return true only if reflection goes outward
         return dot(scattered_ray.direction(), rec.surface_normal) > 0;
     }
 
+    color base_color(const hit_record& rec) const override { return albedo; }
+
+    bool is_mirror() const override { return fuzz == 0; }
+
 private:
     color albedo;
-    double fuzz; // how blurry the reflection is
+    real fuzz; // how blurry the reflection is
 };
 
 // transparent like glass - reflects or refracts light based on angle
 class dielectric : public material {
 public:
-    dielectric(double ref_index) : refractive_index(ref_index) {}
+    dielectric(real ref_index) : refractive_index(ref_index) {}
 
     bool scatter(const ray& incoming_ray, const hit_record& rec, color& attenuation, ray& scattered_ray)
     const override {
+        RT_STAT_INC(dielectric_scatters);
         attenuation = color(1.0, 1.0, 1.0); // no color loss
 
         // choose refraction ratio based on hit direction
-        double eta = rec.is_front_face ? (1.0 / refractive_index) : refractive_index;
+        real eta = rec.is_front_face ? (1.0 / refractive_index) : refractive_index;
 
         vec3 unit_dir = unit_vector(incoming_ray.direction());
 
         // calculate angle info
-        double cos_theta = fmin(dot(-unit_dir, rec.surface_normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+        real cos_theta = std::fmin(dot(-unit_dir, rec.surface_normal), real(1));
+        real sin_theta = std::sqrt(1 - cos_theta * cos_theta);
 
         bool will_refract = eta * sin_theta <= 1.0;
         vec3 scatter_dir;
@@ -92,19 +152,82 @@ public:
             scatter_dir = refract(unit_dir, rec.surface_normal, eta);
         }
 
-        scattered_ray = ray(rec.hit_point, scatter_dir);
+        scattered_ray = spawn_ray(rec, scatter_dir);
         return true;
     }
 
 private:
-    double refractive_index; // how bendy the material is
+    real refractive_index; // how bendy the material is
 
     // Schlick's approximation for reflectivity
-    static double reflectance(double cosine, double eta) {
+    static real reflectance(real cosine, real eta) {
         auto r0 = (1 - eta) / (1 + eta);
         r0 = r0 * r0;
-        return r0 + (1 - r0) * pow((1 - cosine), 5);
+        return r0 + (1 - r0) * std::pow((1 - cosine), 5);
+    }
+};
+
+// a surface that glows with a constant radiance on its front side and reflects nothing.
+// spheres with it are what light_list (light.h) picks up for sampling
+class diffuse_light : public material {
+public:
+    diffuse_light(const color& radiance) : radiance(radiance) {}
+
+    bool scatter(const ray& incoming_ray, const hit_record& rec, color& attenuation, ray& scattered_ray)
+    const override {
+        return false;
     }
+
+    color emitted(const ray& incoming_ray, const hit_record& rec) const override {
+        return rec.is_front_face ? radiance : color(0, 0, 0);
+    }
+
+    const color& emission() const { return radiance; }
+
+private:
+    color radiance;
+};
+
+// all materials of a scene, objects refer to them by a 32 bit index instead of holding a
+// shared_ptr each, so finding and shading a hit never touches a reference count
+class material_table {
+public:
+    // returns the id to give to sphere etc., adding the same material twice gives the same id
+    uint32_t add(shared_ptr<material> m) {
+        auto found = ids.find(m.get());
+        if (found != ids.end()) return found->second;
+        uint32_t id = uint32_t(materials.size());
+        ids.emplace(m.get(), id);
+        types.push_back(type_ids.emplace(std::type_index(typeid(*m)), uint32_t(type_ids.size())).first->second);
+        pdf_flags.push_back(m->has_pdf());
+        mirror_flags.push_back(m->is_mirror());
+        materials.push_back(m);
+        lookup.push_back(m.get());
+        return id;
+    }
+
+    const material& operator[](uint32_t id) const { return *lookup[id]; }
+
+    // small number for the class of material id (every lambertian gets the same one), what
+    // the wavefront integrator groups its scatter calls by
+    uint32_t type(uint32_t id) const { return types[id]; }
+
+    // material::has_pdf of id, kept here so asking costs no virtual call
+    bool has_pdf(uint32_t id) const { return pdf_flags[id]; }
+
+    // material::is_mirror of id
+    bool is_mirror(uint32_t id) const { return mirror_flags[id]; }
+
+    size_t size() const { return materials.size(); }
+
+private:
+    std::vector<shared_ptr<material>> materials; // owns them
+    std::vector<const material*> lookup;         // same order, 8 bytes an entry for the render
+    std::unordered_map<const material*, uint32_t> ids; // for add, a scan would be O(n^2) over a scene
+    std::vector<uint32_t> types;                        // type() of every id
+    std::vector<uint8_t> pdf_flags;                     // has_pdf() of every id
+    std::vector<uint8_t> mirror_flags;                  // is_mirror() of every id
+    std::unordered_map<std::type_index, uint32_t> type_ids;
 };
 
 #endif
@@ -0,0 +1,144 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// wavefront .obj reader for triangle_mesh. only the geometry is read:
+//
+//   v x y z              vertex position (a 4th w coordinate is ignored)
+//   f 1 2 3 4            polygon, corners as v, v/vt, v//vn or v/vt/vn, negative = relative
+//                        to the last vertex so far. polygons are split into a fan of triangles
+//
+// texture coordinates, normals, groups, smoothing and materials (vt vn g o s usemtl mtllib)
+// are skipped, the whole file becomes one mesh with one material
+//
+// the file is memory mapped and parsed in one pass straight out of the mapping, numbers
+// with from_chars (no locale, no copies into strings). the only allocations are the vertex
+// and index arrays themselves, so a mesh of millions of triangles costs about what it takes
+// to hold it, and the os can drop the file's pages again once they're parsed
+class obj_parser {
+public:
+    bool parse(const char* begin, const char* end, const std::string& source_name, mesh_data& mesh) {
+        mesh = mesh_data();
+        source = source_name;
+        line_number = 0;
+
+        // a quick pass counting the v and f lines first, so the arrays are allocated once
+        // at (about) their final size instead of regrowing to up to twice of it
+        size_t vertex_lines = 0, face_lines = 0;
+        for (const char* p = begin; p < end; p++) {
+            if ((p == begin || p[-1] == '\n') && p + 1 < end && is_space(p[1])) {
+                if (*p == 'v') vertex_lines++;
+                else if (*p == 'f') face_lines++;
+            }
+        }
+        mesh.vertices.reserve(vertex_lines);
+        mesh.indices.reserve(face_lines * 3); // exact for triangles, quads grow it once
+
+        const char* p = begin;
+        while (p < end) {
+            line_number++;
+            const char* line_end = p;
+            while (line_end < end && *line_end != '\n') line_end++;
+
+            if (!parse_line(p, line_end, mesh)) return false;
+            p = line_end + 1;
+        }
+
+        if (mesh.indices.empty()) {
+            std::cerr << source << ": no faces\n";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::string source;
+    int line_number = 0;
+
+    bool fail(const std::string& message) const {
+        std::cerr << source << ":" << line_number << ": " << message << "\n";
+        return false;
+    }
+
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    static const char* skip_space(const char* p, const char* end) {
+        while (p < end && is_space(*p)) p++;
+        return p;
+    }
+
+    bool parse_line(const char* p, const char* end, mesh_data& mesh) {
+        p = skip_space(p, end);
+        if (p == end || *p == '#') return true;
+
+        const char* keyword = p;
+        while (p < end && !is_space(*p)) p++;
+        size_t keyword_size = size_t(p - keyword);
+
+        if (keyword_size == 1 && keyword[0] == 'v') return parse_vertex(p, end, mesh);
+        if (keyword_size == 1 && keyword[0] == 'f') return parse_face(p, end, mesh);
+        return true; // everything else isn't geometry
+    }
+
+    bool parse_vertex(const char* p, const char* end, mesh_data& mesh) {
+        real xyz[3];
+        for (real& value : xyz) {
+            p = skip_space(p, end);
+            if (p < end && *p == '+') p++; // from_chars only takes a '-'
+            auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc()) return fail("vertex needs x y z");
+            p = result.ptr;
+        }
+        mesh.vertices.push_back(point3(xyz[0], xyz[1], xyz[2]));
+        return true;
+    }
+
+    // fan around the first corner: (0 1 2) (0 2 3) (0 3 4) ..., only the first and the
+    // previous corner have to be kept, however many corners the polygon has
+    bool parse_face(const char* p, const char* end, mesh_data& mesh) {
+        uint32_t first = 0, previous = 0;
+        int corners = 0;
+        while (true) {
+            p = skip_space(p, end);
+            if (p == end || *p == '#') break; // a comment ends the corners
+
+            long long index;
+            auto result = std::from_chars(p, end, index);
+            if (result.ec != std::errc()) return fail("bad face corner");
+            p = result.ptr;
+            while (p < end && !is_space(*p) && *p != '#') p++; // the /vt/vn part
+
+            long long count = (long long)mesh.vertices.size();
+            if (index < 0) index += count + 1;
+            if (index < 1 || index > count) return fail("face uses vertex " + std::to_string(index) +
+                                                        ", there are " + std::to_string(count) + " so far");
+            uint32_t vertex = uint32_t(index - 1);
+
+            if (corners == 0) first = vertex;
+            if (corners >= 2) {
+                mesh.indices.push_back(first);
+                mesh.indices.push_back(previous);
+                mesh.indices.push_back(vertex);
+            }
+            previous = vertex;
+            corners++;
+        }
+        return corners >= 3 ? true : fail("face needs at least 3 corners");
+    }
+};
+
+inline bool load_obj(const std::string& path, mesh_data& mesh) {
+    mapped_file file;
+    if (!file.open(path)) return false;
+    const char* text = reinterpret_cast<const char*>(file.data());
+    return obj_parser().parse(text, text + file.size(), path, mesh);
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef REAL_H
+#define REAL_H
+
+// scalar type of all the geometry math (vec3, ray, interval, hit distances, bvh boxes)
+// double by default, build with -DRT_FLOAT to render in single precision: half the memory
+// per primitive/bvh node and twice the simd width, at the cost of some accuracy
+#ifdef RT_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
+#endif
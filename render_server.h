@@ -0,0 +1,502 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "camera.h"
+#include "scene_file.h"
+#include "scene_cache.h"
+#include "animation.h"
+#include "image_writer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// a long running renderer: jobs come in as text lines on stdin or over a unix socket, so a
+// pipeline that makes many images pays for process start, scene parsing and bvh builds once
+// instead of once per image. one command per line, '#' starts a comment
+//
+//   load <scene> <file>               parse a text scene (or map a cache) and keep it,
+//                                     bvh and all, under the name <scene>. loading a name
+//                                     again replaces it, jobs already queued keep the old one
+//   unload <scene>
+//   render <job> <scene> [setting value ..] output <file>
+//                                     queue a render of a loaded scene. settings are the
+//                                     camera statements of the scene format (image_width 200,
+//                                     samples_per_pixel 8, lookfrom 6 5 -3, ..) on top of the
+//                                     scene's own, plus
+//                                       priority n   higher goes first, default 0
+//                                       frame n      of an animated scene, default 0
+//                                       denoise      filter the result (denoise.h)
+//   cancel <job>                      drop a queued job or stop the running one
+//   quit                              cancel everything and stop the server
+//
+// every command gets one answer line on the connection that sent it, a render a second one
+// when it's finished:
+//
+//   loaded <scene> <seconds>          queued <job>         done <job> <seconds>
+//   unloaded <scene>                  cancelled <job>      error <what went wrong>
+//
+// jobs run one after another on a pool of threads shared by all of them, each with every
+// thread. the next job is the queued one with the highest priority, the earliest of those
+// if there's a tie, a running job isn't interrupted for a higher priority one. scenes are
+// loaded on the thread of the connection that asked, so a big load doesn't hold up renders
+//
+// on stdin the server stops at the end of the input, after the jobs it queued are done
+class render_server {
+public:
+    int thread_count = 0; // of the shared pool, 0 = every core
+
+    // command line settings (integrator, light sampling ..) every job's camera starts with,
+    // the scene's and the job's camera settings go on top
+    std::function<void(camera&)> setup;
+
+    render_server() = default;
+    render_server(const render_server&) = delete;
+    render_server& operator=(const render_server&) = delete;
+
+    // commands from in_fd, answers to out_fd, until the input ends or a quit
+    bool serve_stream(int in_fd, int out_fd) {
+        // the reader of out_fd can go away too (the other end of a pipe quits), that
+        // should end up as a failed write, not kill the server with jobs still queued
+        signal(SIGPIPE, SIG_IGN);
+        start();
+        auto client = std::make_shared<connection>(out_fd, false);
+        read_commands(in_fd, client);
+        wait_idle();
+        stop();
+        return true;
+    }
+
+    // accepts connections on a unix socket at path until one of them sends quit, every
+    // connection has its own reader thread
+    bool serve_socket(const std::string& path) {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "socket path too long: " << path << "\n";
+            return false;
+        }
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            std::cerr << "could not create a socket: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str()); // left over from a server that didn't shut down
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listener, 16) != 0) {
+            std::cerr << "could not listen on " << path << ": " << std::strerror(errno) << "\n";
+            close(listener);
+            return false;
+        }
+
+        // a client that goes away mid answer mustn't kill the server
+        signal(SIGPIPE, SIG_IGN);
+        start();
+
+        while (!quitting.load()) {
+            // wakes up now and then to notice a quit from one of the connections
+            pollfd waiting{ listener, POLLIN, 0 };
+            if (poll(&waiting, 1, 200) <= 0) continue;
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) continue;
+
+            auto client = std::make_shared<connection>(fd, true);
+            {
+                std::lock_guard<std::mutex> lock(readers_mutex);
+                clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                             [](const std::weak_ptr<connection>& c) { return c.expired(); }),
+                              clients.end());
+                clients.push_back(client);
+                reader_count++;
+            }
+            std::thread([this, client] {
+                read_commands(client->fd, client);
+                std::lock_guard<std::mutex> lock(readers_mutex);
+                reader_count--;
+                readers_done.notify_all();
+            }).detach();
+        }
+
+        // readers still blocked in read() see an end of input
+        {
+            std::unique_lock<std::mutex> lock(readers_mutex);
+            for (auto& weak : clients)
+                if (auto client = weak.lock()) shutdown(client->fd, SHUT_RDWR);
+            readers_done.wait(lock, [this] { return reader_count == 0; });
+        }
+        close(listener);
+        unlink(path.c_str());
+        stop();
+        return true;
+    }
+
+private:
+    // where the answers to one client go, jobs keep it alive until their done line is out.
+    // a socket is closed with the last reference to it
+    struct connection {
+        int fd;
+        bool owns_fd;
+        std::mutex mutex;
+
+        connection(int fd, bool owns_fd) : fd(fd), owns_fd(owns_fd) {}
+        ~connection() {
+            if (owns_fd) close(fd);
+        }
+        connection(const connection&) = delete;
+        connection& operator=(const connection&) = delete;
+
+        void send(const std::string& text) {
+            std::string line = text + "\n";
+            std::lock_guard<std::mutex> lock(mutex);
+            const char* p = line.data();
+            size_t left = line.size();
+            while (left > 0) {
+                ssize_t n = write(fd, p, left);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return; // client is gone, nothing to tell it anymore
+                p += n;
+                left -= size_t(n);
+            }
+        }
+    };
+
+    // the scene description has to stay next to the flat_scene that points into it
+    struct loaded_scene {
+        scene_description description;
+        flat_scene world;
+        int frame = 0; // the frame the spheres and the bvh are at
+    };
+
+    struct render_job {
+        std::string id;
+        int priority = 0;
+        uint64_t order = 0; // submission order, ties in priority go first come first served
+        std::shared_ptr<loaded_scene> scene;
+        std::string settings; // the render line after the scene name, parsed again when it runs
+        int frame = 0;
+        bool denoise = false;
+        std::string output_path;
+        std::shared_ptr<connection> client;
+        std::atomic<bool> cancelled{ false };
+    };
+
+    std::mutex scenes_mutex;
+    std::map<std::string, std::shared_ptr<loaded_scene>> scenes;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::vector<std::shared_ptr<render_job>> queue;
+    std::shared_ptr<render_job> running; // taken off the queue, being rendered
+    uint64_t next_order = 0;
+    bool stopping = false;
+    std::atomic<bool> quitting{ false };
+
+    std::unique_ptr<thread_pool> pool;
+    std::thread dispatcher;
+
+    // socket connections, so a quit can end the reads of the others
+    std::mutex readers_mutex;
+    std::condition_variable readers_done;
+    std::vector<std::weak_ptr<connection>> clients;
+    int reader_count = 0;
+
+    void start() {
+        pool = std::make_unique<thread_pool>(thread_count);
+        dispatcher = std::thread([this] { run_jobs(); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_changed.notify_all();
+        if (dispatcher.joinable()) dispatcher.join();
+        pool.reset();
+    }
+
+    // until the queue is empty and nothing is running
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_changed.wait(lock, [this] { return queue.empty() && !running; });
+    }
+
+    void read_commands(int fd, const std::shared_ptr<connection>& client) {
+        std::string buffer;
+        char chunk[4096];
+        while (!quitting.load()) {
+            auto newline = buffer.find('\n');
+            if (newline == std::string::npos) {
+                ssize_t n = read(fd, chunk, sizeof(chunk));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                buffer.append(chunk, size_t(n));
+                continue;
+            }
+            std::string text = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            run_command(text, client);
+        }
+        // a last line without a newline still counts
+        if (!quitting.load() && !buffer.empty()) run_command(buffer, client);
+    }
+
+    void run_command(std::string text, const std::shared_ptr<connection>& client) {
+        auto hash = text.find('#');
+        if (hash != std::string::npos) text.erase(hash);
+        std::istringstream line(text);
+        std::string command;
+        if (!(line >> command)) return;
+
+        if (command == "load") load(line, *client);
+        else if (command == "unload") unload(line, *client);
+        else if (command == "render") submit(line, client);
+        else if (command == "cancel") cancel(line, *client);
+        else if (command == "quit") quit();
+        else client->send("error unknown command '" + command + "'");
+    }
+
+    void load(std::istream& line, connection& client) {
+        std::string name, path, extra;
+        if (!(line >> name >> path) || (line >> extra)) {
+            client.send("error load needs a scene name and a file");
+            return;
+        }
+
+        auto start_time = std::chrono::steady_clock::now();
+        auto scene = std::make_shared<loaded_scene>();
+        if (flat_scene::is_cache(path)) {
+            if (!scene->world.open_cache(path)) {
+                client.send("error could not load " + path);
+                return;
+            }
+            scene->description.camera = scene->world.camera;
+        } else {
+            if (!load_scene_text(path, scene->description)) {
+                client.send("error could not load " + path);
+                return;
+            }
+            apply_frame(scene->description, 0);
+            scene->world.build(scene->description);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+        {
+            std::lock_guard<std::mutex> lock(scenes_mutex);
+            scenes[name] = scene;
+        }
+        client.send("loaded " + name + " " + std::to_string(elapsed.count()));
+    }
+
+    void unload(std::istream& line, connection& client) {
+        std::string name;
+        if (!(line >> name)) {
+            client.send("error unload needs a scene name");
+            return;
+        }
+        std::lock_guard<std::mutex> lock(scenes_mutex);
+        if (scenes.erase(name) == 0) client.send("error no scene '" + name + "'");
+        else client.send("unloaded " + name);
+    }
+
+    void submit(std::istream& line, const std::shared_ptr<connection>& client) {
+        auto job = std::make_shared<render_job>();
+        job->client = client;
+        std::string scene_name;
+        if (!(line >> job->id >> scene_name)) {
+            client->send("error render needs a job name and a scene");
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(scenes_mutex);
+            auto it = scenes.find(scene_name);
+            if (it == scenes.end()) {
+                client->send("error " + job->id + ": no scene '" + scene_name + "'");
+                return;
+            }
+            job->scene = it->second;
+        }
+
+        // the camera settings go on top of the camera of the frame the job asks for, so
+        // they're checked on a scratch copy now and applied for real when it runs
+        std::getline(line, job->settings);
+        camera_settings check;
+        std::string error;
+        if (!parse_job_settings(*job, check, error)) {
+            client->send("error " + job->id + ": " + error);
+            return;
+        }
+        if (job->output_path.empty() || job->output_path == "-") {
+            client->send("error " + job->id + ": needs an output file");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (stopping) return;
+            job->order = next_order++;
+            queue.push_back(job);
+        }
+        client->send("queued " + job->id);
+        queue_changed.notify_all();
+    }
+
+    // "priority 2 image_width 200 output a.png .." of a render line into job and settings
+    static bool parse_job_settings(render_job& job, camera_settings& settings, std::string& error) {
+        std::istringstream line(job.settings);
+        std::string keyword;
+        while (line >> keyword) {
+            bool ok = true;
+            if (keyword == "priority") ok = bool(line >> job.priority);
+            else if (keyword == "frame") ok = bool(line >> job.frame) && job.frame >= 0;
+            else if (keyword == "denoise") job.denoise = true;
+            else if (keyword == "output") ok = bool(line >> job.output_path);
+            else if (!scene_text_parser::parse_camera_setting(keyword, line, settings, ok)) {
+                error = "unknown setting '" + keyword + "'";
+                return false;
+            }
+            if (!ok) {
+                error = "bad value for " + keyword;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void cancel(std::istream& line, connection& client) {
+        std::string id;
+        if (!(line >> id)) {
+            client.send("error cancel needs a job name");
+            return;
+        }
+
+        std::shared_ptr<render_job> dropped;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (running && running->id == id) {
+                // the dispatcher answers once the render has stopped
+                running->cancelled = true;
+                return;
+            }
+            for (size_t i = 0; i < queue.size(); i++) {
+                if (queue[i]->id != id) continue;
+                dropped = queue[i];
+                queue.erase(queue.begin() + long(i));
+                break;
+            }
+        }
+        if (!dropped) {
+            client.send("error no queued or running job '" + id + "'");
+            return;
+        }
+        queue_changed.notify_all();
+        dropped->client->send("cancelled " + id);
+    }
+
+    void quit() {
+        quitting = true;
+        std::vector<std::shared_ptr<render_job>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            dropped.swap(queue);
+            if (running) running->cancelled = true;
+        }
+        queue_changed.notify_all();
+        for (auto& job : dropped) job->client->send("cancelled " + job->id);
+    }
+
+    void run_jobs() {
+        while (true) {
+            std::shared_ptr<render_job> job;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_changed.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+
+                size_t best = 0;
+                for (size_t i = 1; i < queue.size(); i++) {
+                    if (queue[i]->priority > queue[best]->priority ||
+                        (queue[i]->priority == queue[best]->priority && queue[i]->order < queue[best]->order))
+                        best = i;
+                }
+                job = queue[best];
+                queue.erase(queue.begin() + long(best));
+                running = job;
+            }
+
+            render(*job);
+
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                running.reset();
+            }
+            queue_changed.notify_all();
+        }
+    }
+
+    // only ever called from the dispatcher, so it's the only one moving a scene's spheres
+    void render(render_job& job) {
+        auto start_time = std::chrono::steady_clock::now();
+        loaded_scene& scene = *job.scene;
+        if (!scene.description.tracks.empty() && job.frame != scene.frame) {
+            if (apply_frame(scene.description, job.frame)) scene.world.refit();
+            scene.frame = job.frame;
+        }
+
+        camera_settings settings = scene.description.camera;
+        std::string error;
+        parse_job_settings(job, settings, error); // can't fail, it didn't when it was queued
+
+        camera cam;
+        if (setup) setup(cam);
+        settings.apply(cam);
+        // every job renders in this process on the shared threads, straight into its file
+        cam.shared_pool = pool.get();
+        cam.cancel = &job.cancelled;
+        cam.show_progress = false;
+        cam.process_count = 0;
+        cam.checkpoint_path.clear();
+        cam.denoise = job.denoise;
+        cam.albedo_path.clear();
+        cam.normal_path.clear();
+
+        framebuffer image = cam.render_image(scene.world);
+        if (job.cancelled.load()) {
+            job.client->send("cancelled " + job.id);
+            return;
+        }
+        if (cam.last_render_failed()) {
+            job.client->send("error " + job.id + ": could not render");
+            return;
+        }
+        if (!write_image(image, job.output_path, image_format_from_path(job.output_path, image_format::ppm))) {
+            job.client->send("error " + job.id + ": could not write " + job.output_path);
+            return;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        job.client->send("done " + job.id + " " + std::to_string(elapsed.count()));
+    }
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// pcg32 random number generator (Melissa O'Neill, pcg-random.org)
+// 64 bit state, 32 bit output, a multiply and a few shifts per number so it's far cheaper
+// than std::rand and has much better low bits. the stream picks one of 2^63 independent
+// sequences, we use it to give every sample its own sequence
+class pcg32 {
+public:
+    pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+    pcg32(uint64_t init_state, uint64_t init_stream) { seed(init_state, init_stream); }
+
+    void seed(uint64_t init_state, uint64_t init_stream) {
+        state = 0;
+        increment = (init_stream << 1u) | 1u; // increment has to be odd
+        next_uint();
+        state += init_state;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old_state = state;
+        state = old_state * 6364136223846793005ULL + increment;
+        uint32_t xorshifted = uint32_t(((old_state >> 18u) ^ old_state) >> 27u);
+        uint32_t rot = uint32_t(old_state >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+
+    // random real in [0,1) with the full 53 bits of a double
+    double next_double() {
+        uint64_t hi = next_uint() >> 5; // 27 bits
+        uint64_t lo = next_uint() >> 6; // 26 bits
+        return double((hi << 26) | lo) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint64_t state;
+    uint64_t increment;
+};
+
+// splitmix64 finalizer, turns structured input (pixel coordinates) into well mixed seeds
+inline uint64_t mix_bits(uint64_t v) {
+    v += 0x9e3779b97f4a7c15ULL;
+    v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+    return v ^ (v >> 31);
+}
+
+// every thread has its own generator so there's no shared state between render threads
+inline pcg32& thread_rng() {
+    thread_local pcg32 rng;
+    return rng;
+}
+
+// restarts the calling thread's generator for one sample of one pixel
+// since the sequence depends only on (x, y, sample, seed) and not on which thread picked up
+// the pixel or in what order, the image is bit identical for any thread count
+inline void seed_sample_rng(uint32_t x, uint32_t y, uint32_t sample, uint64_t seed = 0) {
+    uint64_t pixel_key = (uint64_t(y) << 32) | x;
+    // sample goes into both the state and the stream, pcg streams that start from the same
+    // state are correlated
+    thread_rng().seed(mix_bits(pixel_key ^ mix_bits(seed ^ mix_bits(sample))), sample);
+}
+
+#endif
@@ -5,7 +5,10 @@
 #include <iostream>
 #include <limits>
 #include <memory>
-#include<cstdlib>
+
+#include "real.h"
+#include "rng.h"
+#include "sampler.h"
 
 
 // C++ Std Usings
@@ -15,8 +18,8 @@ using std::shared_ptr;
 
 // Constants
 
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = real(3.1415926535897932385);
 
 // Utility Functions
 
@@ -26,7 +29,8 @@ inline double degrees_to_radians(double degrees) {
 
 inline double random_double() {
     // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    // comes from the per thread pcg32 in rng.h, the camera reseeds it for every sample
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
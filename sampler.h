@@ -0,0 +1,284 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rng.h"
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+// where the 2d random points of a sample come from: the pixel position, the lens position,
+// every bounce direction and every light sample each take the next pair of dimensions. the
+// warps that turn them into disks and directions (vec3.h) are closed form, so neighbouring
+// points stay neighbours and a well spread set of points in the square gives a well spread
+// set of directions
+//
+//   independent - both numbers straight from the sample's pcg32, plain monte carlo
+//   stratified  - correlated multi-jittered sampling (Kensler 2013): the pixel's samples
+//                 fall into an n x m grid with one per cell in every row and column, per
+//                 pair of dimensions with its own shuffle
+//   sobol       - owen scrambled sobol points (Burley 2020): the first two sobol dimensions
+//                 for every pair, each pair with its own hashed scramble and its own shuffle
+//                 of the sample index. any power of two of consecutive samples is a (0,2) net
+//   blue_noise  - the same sobol points handed out over the whole image in z order with a
+//                 hashed shuffle of the base 4 digits (Ahmed and Wonka 2020), so neighbouring
+//                 pixels get complementary samples and what error is left looks like high
+//                 frequency noise instead of blotches
+//
+// every point is uniform on its own whatever the scramble, so any subset of a pixel's
+// samples (adaptive sampling, a resumed checkpoint) is still unbiased, only less evenly
+// spread. 1d decisions (russian roulette, reflect or refract, which light) stay with pcg32
+enum class sampler_kind : uint8_t { independent, stratified, sobol, blue_noise };
+
+inline bool sampler_kind_from_name(const std::string& name, sampler_kind& kind) {
+    if (name == "independent") kind = sampler_kind::independent;
+    else if (name == "stratified") kind = sampler_kind::stratified;
+    else if (name == "sobol") kind = sampler_kind::sobol;
+    else if (name == "blue-noise") kind = sampler_kind::blue_noise;
+    else return false;
+    return true;
+}
+
+namespace sampling {
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = __builtin_bswap32(x);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+inline uint64_t hash(uint32_t a, uint32_t b) {
+    return mix_bits((uint64_t(a) << 32) | b);
+}
+
+// the core of owen scrambling (Laine and Karras 2011, constants of Burley 2020): works on
+// bit reversed numbers, every bit gets flipped or not by a hash of the seed and the bits
+// below it, which are the more significant ones before the reversal. so
+// reverse_bits(laine_karras(reverse_bits(x), seed)) is x owen scrambled
+inline uint32_t laine_karras(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// sobol dimension 0 is reverse_bits(index) (van der Corput). dimension 1 has the direction
+// numbers v_k = v_(k-1) ^ (v_(k-1) >> 1), here bit reversed and xor-ed together for every
+// byte value, so a point is 4 lookups instead of a loop over the index bits
+struct sobol_1_table {
+    uint32_t bytes[4][256];
+};
+
+constexpr sobol_1_table make_sobol_1_table() {
+    uint32_t directions[32] = {};
+    uint32_t v = 1u << 31;
+    for (int k = 0; k < 32; k++, v ^= v >> 1) {
+        uint32_t reversed = 0;
+        for (int bit = 0; bit < 32; bit++)
+            if (v & (1u << bit)) reversed |= 1u << (31 - bit);
+        directions[k] = reversed;
+    }
+    sobol_1_table table = {};
+    for (int byte = 0; byte < 4; byte++) {
+        for (int value = 0; value < 256; value++) {
+            uint32_t x = 0;
+            for (int bit = 0; bit < 8; bit++)
+                if (value & (1 << bit)) x ^= directions[8 * byte + bit];
+            table.bytes[byte][value] = x;
+        }
+    }
+    return table;
+}
+
+inline constexpr sobol_1_table sobol_1_bytes = make_sobol_1_table();
+
+// reverse_bits of sobol dimension 1
+inline uint32_t sobol_1_reversed(uint32_t index) {
+    return sobol_1_bytes.bytes[0][index & 0xff] ^ sobol_1_bytes.bytes[1][(index >> 8) & 0xff] ^
+           sobol_1_bytes.bytes[2][(index >> 16) & 0xff] ^ sobol_1_bytes.bytes[3][index >> 24];
+}
+
+inline double to_unit(uint32_t bits) { return bits * (1.0 / 4294967296.0); }
+
+// random permutation of [0, length) by pattern, index >= length is wrapped into it
+// (Kensler 2013, hash based, no table)
+inline uint32_t permute(uint32_t i, uint32_t length, uint32_t pattern) {
+    uint32_t w = length - 1;
+    w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+    do {
+        i ^= pattern; i *= 0xe170893du; i ^= pattern >> 16;
+        i ^= (i & w) >> 4;
+        i ^= pattern >> 8; i *= 0x0929eb3fu; i ^= pattern >> 23;
+        i ^= (i & w) >> 1; i *= 1 | pattern >> 27;
+        i *= 0x6935fa69u; i ^= (i & w) >> 11;
+        i *= 0x74dcb303u; i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u; i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu; i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + pattern) % length;
+}
+
+inline uint32_t morton_2d(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ffu;
+        v = (v | (v << 4)) & 0x0f0f0f0fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+inline int log2_ceil(uint32_t v) {
+    int bits = 0;
+    while ((uint64_t(1) << bits) < v) bits++;
+    return bits;
+}
+
+} // namespace sampling
+
+// the sampler state of one sample: which sample of which pixel, and how many dimensions it
+// used so far. every thread has one next to its pcg32 (thread_sampler), the camera resets
+// both at the start of every sample
+struct sample_cursor {
+    sampler_kind kind = sampler_kind::independent;
+    uint8_t base4_digits = 0;     // blue noise: of the z order index
+    uint8_t odd_bit = 0;          // blue noise: log2 of the sample count is odd
+    uint32_t dimension = 0;       // next pair
+    uint32_t sample = 0;
+    uint32_t reversed_sample = 0; // sobol: reverse_bits(sample)
+    uint32_t sample_count = 1;    // stratified: samples per pixel, in columns x rows cells
+    uint32_t columns = 1, rows = 1;
+    uint32_t pixel_seed = 0;      // hash of pixel and image seed, picks the scrambles
+    uint32_t image_seed = 0;
+    uint32_t z_index = 0;         // blue noise: pixel in z order, times the count, plus sample
+
+    // sample of pixel x, y out of samples per pixel, in an image that fits in a square
+    // of resolution x resolution pixels
+    void start(sampler_kind sampler, uint32_t x, uint32_t y, uint32_t sample_index, uint32_t samples,
+               uint64_t seed, uint32_t resolution) {
+        kind = sampler;
+        dimension = 0;
+        sample = sample_index;
+        sample_count = samples > 0 ? samples : 1;
+        image_seed = uint32_t(mix_bits(seed));
+        pixel_seed = uint32_t(mix_bits((uint64_t(y) << 32 | x) ^ mix_bits(seed)));
+        reversed_sample = sampling::reverse_bits(sample);
+        if (kind == sampler_kind::stratified) {
+            columns = uint32_t(std::sqrt(double(sample_count)));
+            rows = (sample_count + columns - 1) / columns;
+        }
+        if (kind != sampler_kind::blue_noise) return;
+
+        // the z order index has to fit in the 32 bits of the sobol points, bigger images
+        // or sample counts fall back to sobol
+        int log2_samples = sampling::log2_ceil(sample_count);
+        int log2_resolution = sampling::log2_ceil(resolution);
+        if (2 * log2_resolution + log2_samples > 32 || sample >= (uint64_t(1) << log2_samples)) {
+            kind = sampler_kind::sobol;
+            return;
+        }
+        z_index = uint32_t((uint64_t(sampling::morton_2d(x, y)) << log2_samples) | sample);
+        base4_digits = uint8_t(log2_resolution + (log2_samples + 1) / 2);
+        odd_bit = uint8_t(log2_samples & 1);
+    }
+
+    // the next two dimensions of this sample, in [0,1)
+    void next_2d(double& u, double& v) {
+        uint32_t pair = dimension++;
+        if (kind == sampler_kind::independent || pair >= max_pairs) {
+            u = thread_rng().next_double();
+            v = thread_rng().next_double();
+        } else {
+            scrambled_2d(pair, u, v);
+        }
+    }
+
+    // leaves out the next two dimensions, for a draw that isn't needed this time (light
+    // sampling at a mirror), so the later draws keep the dimensions they always get
+    void skip_2d() { dimension++; }
+
+    // pixel, lens and the first few bounces are where well spread points pay off, deeper
+    // bounces contribute little and take plain pcg32 numbers (same images at 4 or 1000 pairs)
+    static constexpr uint32_t max_pairs = 6;
+
+private:
+    void scrambled_2d(uint32_t pair, double& u, double& v) const {
+        using namespace sampling;
+        if (kind == sampler_kind::stratified) {
+            stratified(uint32_t(hash(pixel_seed, pair)), u, v);
+            return;
+        }
+
+        // sobol shuffles the pixel's samples with an owen scramble of the index, blue noise
+        // with its digit permutations of the z order. the point is then owen scrambled,
+        // dimension 0 (the reversed index) and dimension 1 with seeds of their own
+        uint64_t seeds;
+        uint32_t index;
+        if (kind == sampler_kind::sobol) {
+            seeds = hash(pixel_seed, pair);
+            index = reverse_bits(laine_karras(reversed_sample, uint32_t(seeds)));
+        } else {
+            seeds = hash(image_seed, pair);
+            index = blue_noise_index(pair);
+        }
+        uint32_t seed_u = uint32_t(seeds >> 32);
+        uint32_t seed_v = uint32_t((seeds * 0xd6e8feb86659fd93ull) >> 32);
+        u = to_unit(reverse_bits(laine_karras(index, seed_u)));
+        v = to_unit(reverse_bits(laine_karras(sobol_1_reversed(index), seed_v)));
+    }
+
+    // Kensler's cmj: a columns x rows grid of cells, sample s lands in column sx of row sy
+    // and at the sub position that keeps the rows and columns of the fine grid filled too
+    void stratified(uint32_t pattern, double& u, double& v) const {
+        uint32_t s = sampling::permute(sample, sample_count, pattern * 0x51633e2du);
+        uint32_t sx = sampling::permute(s % columns, columns, pattern * 0x68bc21ebu);
+        uint32_t sy = sampling::permute(s / columns, rows, pattern * 0x02e5be93u);
+        uint64_t jitter = sampling::hash(s, pattern);
+        double jx = sampling::to_unit(uint32_t(jitter));
+        double jy = sampling::to_unit(uint32_t(jitter >> 32));
+        u = (sx + (sy + jx) / rows) / columns;
+        v = (s + jy) / sample_count;
+    }
+
+    // the z order index with every base 4 digit put through one of the 24 permutations of
+    // 0..3, picked by a hash of the digits above it and the dimension
+    uint32_t blue_noise_index(uint32_t pair) const {
+        static const uint8_t permutations[24][4] = {
+            { 0, 1, 2, 3 }, { 0, 1, 3, 2 }, { 0, 2, 1, 3 }, { 0, 2, 3, 1 }, { 0, 3, 2, 1 }, { 0, 3, 1, 2 },
+            { 1, 0, 2, 3 }, { 1, 0, 3, 2 }, { 1, 2, 0, 3 }, { 1, 2, 3, 0 }, { 1, 3, 2, 0 }, { 1, 3, 0, 2 },
+            { 2, 1, 0, 3 }, { 2, 1, 3, 0 }, { 2, 0, 1, 3 }, { 2, 0, 3, 1 }, { 2, 3, 0, 1 }, { 2, 3, 1, 0 },
+            { 3, 1, 2, 0 }, { 3, 1, 0, 2 }, { 3, 2, 1, 0 }, { 3, 2, 0, 1 }, { 3, 0, 2, 1 }, { 3, 0, 1, 2 }
+        };
+        // a multiplicative hash per digit, its top bits pick the permutation
+        uint32_t salt = uint32_t(sampling::hash(image_seed, pair));
+        auto pick = [salt](uint32_t higher) {
+            uint32_t h = ((higher ^ salt) * 0x9e3779b1u) ^ salt;
+            h *= 0x2c1b3c6du;
+            return uint32_t((uint64_t(h) * 24) >> 32);
+        };
+        uint32_t index = 0;
+        for (int i = base4_digits - 1; i >= odd_bit; i--) {
+            int shift = 2 * i - odd_bit;
+            uint32_t digit = (z_index >> shift) & 3;
+            uint32_t higher = shift + 2 < 32 ? z_index >> (shift + 2) : 0;
+            // the level goes into the hash too, or every level would shuffle alike
+            index |= uint32_t(permutations[pick(higher + (uint32_t(i) << 27))][digit]) << shift;
+        }
+        if (odd_bit) index |= (z_index & 1) ^ (pick((z_index >> 1) ^ 0x40000000u) & 1);
+        return index;
+    }
+};
+
+inline sample_cursor& thread_sampler() {
+    thread_local sample_cursor cursor;
+    return cursor;
+}
+
+#endif
@@ -0,0 +1,359 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "bvh.h"
+#include "instance.h"
+#include "mapped_file.h"
+#include "scene_file.h"
+#include "sphere.h"
+#include "static_scene.h"
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// scene rendered straight from the flat arrays of a scene_description: spheres are
+// sphere_records tested with the free sphere functions (sphere.h), materials are the
+// static_scene variants, and a bvh_tree indexes the spheres in leaf order
+//
+// the arrays can be the scene's own vectors (build) or point into a memory mapped scene
+// cache (open_cache), in which case loading is just checking the header: no parsing, no
+// allocation per object and no bvh build. camera::render takes it like a virtual_scene
+//
+// meshes of a text scene become triangle_meshes with their own bvh, its objects the
+// prototypes of an instance_set. a ray tests the spheres' tree, every mesh and then the
+// instances. spheres with a light material are the scene's light_list
+class flat_scene {
+public:
+    camera_settings camera;
+
+    // builds the bvh over scene.spheres, which get reordered into leaf order (the animation
+    // tracks are updated to match). the scene has to stay around while this is used, if its
+    // spheres move call refit(). the meshes and objects are moved out of the scene
+    void build(scene_description& scene) {
+        mapping.close();
+        meshes.clear();
+        for (auto& m : scene.meshes) meshes.emplace_back(std::move(m.data), m.material_id);
+        scene.meshes.clear();
+
+        instances = instance_set();
+        for (auto& m : scene.objects)
+            instances.add_prototype(make_shared<triangle_mesh>(std::move(m.data), m.material_id));
+        scene.objects.clear();
+        for (const auto& placement : scene.instances) instances.add(placement.object, placement.object_to_world);
+        instances.build();
+
+        camera = scene.camera;
+        set_materials(scene.materials.data(), scene.materials.size());
+
+        std::vector<uint32_t> order = tree.build(sphere_boxes(scene.spheres.data(), scene.spheres.size()));
+
+        std::vector<sphere_record> ordered;
+        std::vector<uint32_t> new_index(order.size());
+        ordered.reserve(scene.spheres.size());
+        for (uint32_t index : order) {
+            new_index[index] = uint32_t(ordered.size());
+            ordered.push_back(scene.spheres[index]);
+        }
+        scene.spheres = std::move(ordered);
+        for (auto& track : scene.tracks)
+            if (track.target == track_target::sphere_center) track.sphere_index = new_index[track.sphere_index];
+
+        spheres = scene.spheres.data();
+        sphere_count = scene.spheres.size();
+        collect_lights();
+    }
+
+    // the scene's spheres moved (not added or removed): fits the bvh around them again
+    // instead of building a new one
+    void refit() {
+        tree.refit(sphere_boxes(spheres, sphere_count));
+        collect_lights();
+    }
+
+    // maps a file written by write_cache, false (with a message) if it isn't one, was
+    // written by a build with the other precision or doesn't hold together: every sphere's
+    // material and every bvh child and leaf range is checked before anything indexes with
+    // them, so a corrupt or stale cache is refused instead of read out of bounds. that reads
+    // the spheres and nodes once, still far less than parsing and building
+    bool open_cache(const std::string& path) {
+        meshes.clear();
+        instances = instance_set();
+        if (!mapping.open(path)) return false;
+
+        cache_header header;
+        if (mapping.size() < sizeof(header)) return bad_cache(path, "too small");
+        std::memcpy(&header, mapping.data(), sizeof(header));
+        if (std::memcmp(header.magic, cache_magic, sizeof(header.magic)) != 0)
+            return bad_cache(path, "not a scene cache");
+        if (header.version != cache_version) return bad_cache(path, "written by another version");
+        if (header.real_size != sizeof(real))
+            return bad_cache(path, sizeof(real) == sizeof(float) ? "written by the double build"
+                                                                 : "written by the float build");
+        if (!section_fits(header.material_offset, header.material_count, sizeof(material_record)) ||
+            !section_fits(header.sphere_offset, header.sphere_count, sizeof(sphere_record)) ||
+            !section_fits(header.node_offset, header.node_count, sizeof(bvh_tree::flat_node)))
+            return bad_cache(path, "truncated");
+
+        const sphere_record* records = reinterpret_cast<const sphere_record*>(mapping.data() + header.sphere_offset);
+        for (uint64_t i = 0; i < header.sphere_count; i++)
+            if (records[i].material_id >= header.material_count) return bad_cache(path, "sphere with a missing material");
+        if (!bvh_tree::valid_nodes(reinterpret_cast<const bvh_tree::flat_node*>(mapping.data() + header.node_offset),
+                                   size_t(header.node_count), size_t(header.sphere_count)))
+            return bad_cache(path, "broken bvh");
+
+        camera = header.camera;
+        set_materials(reinterpret_cast<const material_record*>(mapping.data() + header.material_offset),
+                      size_t(header.material_count));
+        spheres = records;
+        sphere_count = size_t(header.sphere_count);
+        tree.use_nodes(reinterpret_cast<const bvh_tree::flat_node*>(mapping.data() + header.node_offset),
+                       size_t(header.node_count));
+        collect_lights();
+        return true;
+    }
+
+    // header, then materials, spheres (leaf order) and bvh nodes, each section 64 byte aligned
+    // so the mapped arrays can be used in place
+    bool write_cache(const std::string& path) const {
+        if (!meshes.empty() || instances.size() > 0) {
+            std::cerr << "scene caches hold spheres only, this scene has meshes\n";
+            return false;
+        }
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "could not open " << path << " for writing\n";
+            return false;
+        }
+
+        cache_header header;
+        std::memset(static_cast<void*>(&header), 0, sizeof(header)); // no stray bytes in the padding
+        std::memcpy(header.magic, cache_magic, sizeof(header.magic));
+        header.version = cache_version;
+        header.real_size = sizeof(real);
+        header.camera = camera;
+        header.material_count = material_records.size();
+        header.sphere_count = sphere_count;
+        header.node_count = tree.node_count();
+
+        uint64_t offset = align(sizeof(header));
+        header.material_offset = offset;
+        offset = align(offset + header.material_count * sizeof(material_record));
+        header.sphere_offset = offset;
+        offset = align(offset + header.sphere_count * sizeof(sphere_record));
+        header.node_offset = offset;
+
+        uint64_t written = 0;
+        auto put = [&](const void* data, uint64_t at, uint64_t bytes) {
+            static const char zeros[section_alignment] = {};
+            file.write(zeros, std::streamsize(at - written));
+            file.write(static_cast<const char*>(data), std::streamsize(bytes));
+            written = at + bytes;
+        };
+        put(&header, 0, sizeof(header));
+        put(material_records.data(), header.material_offset, header.material_count * sizeof(material_record));
+        put(spheres, header.sphere_offset, header.sphere_count * sizeof(sphere_record));
+        put(tree.node_data(), header.node_offset, header.node_count * sizeof(bvh_tree::flat_node));
+        return bool(file);
+    }
+
+    // true if the file starts like a scene cache, so one option can take either format
+    static bool is_cache(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        char magic[sizeof(cache_magic)] = {};
+        file.read(magic, sizeof(magic));
+        return file && std::memcmp(magic, cache_magic, sizeof(magic)) == 0;
+    }
+
+    size_t size() const { return sphere_count; }
+    size_t node_count() const { return tree.node_count(); }
+    size_t mesh_count() const { return meshes.size(); }
+    size_t instance_count() const { return instances.size(); }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const {
+        bool any_hit = tree.traverse(r, ray_t, [&](uint32_t i, interval& t) {
+            real root;
+            if (!intersect_sphere(spheres[i].center, spheres[i].radius, r, t, root)) return false;
+            rec.hit_t = root;
+            rec.hit_object = nullptr;
+            rec.primitive_index = i;
+            t.max = root;
+            return true;
+        });
+        if (any_hit) ray_t.max = rec.hit_t;
+        for (const auto& mesh : meshes) {
+            if (mesh.triangle_mesh::hit(r, ray_t, rec)) {
+                any_hit = true;
+                ray_t.max = rec.hit_t;
+            }
+        }
+        if (instances.size() > 0 && instances.instance_set::hit(r, ray_t, rec)) any_hit = true;
+        if (!any_hit) return false;
+
+        // spheres are records and leave hit_object empty, meshes and instances set it
+        if (rec.hit_object) {
+            rec.hit_object->compute_surface(r, rec);
+            return true;
+        }
+        const sphere_record& s = spheres[rec.primitive_index];
+        sphere_surface(s.center, s.radius, s.material_id, r, rec);
+        return true;
+    }
+
+    bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::scatter(r, rec, attenuation, scattered);
+        }, materials[rec.material_id]);
+    }
+
+    color emitted(const ray& r, const hit_record& rec) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::emitted(r, rec);
+        }, materials[rec.material_id]);
+    }
+
+    color evaluate(const ray& r, const hit_record& rec, const vec3& dir, real& pdf) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::evaluate(r, rec, dir, pdf);
+        }, materials[rec.material_id]);
+    }
+
+    bool has_pdf(const hit_record& rec) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::has_pdf();
+        }, materials[rec.material_id]);
+    }
+
+    bool is_mirror(const hit_record& rec) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::is_mirror();
+        }, materials[rec.material_id]);
+    }
+
+    color base_color(const hit_record& rec) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::base_color(rec);
+        }, materials[rec.material_id]);
+    }
+
+    uint32_t material_type(const hit_record& rec) const { return uint32_t(materials[rec.material_id].index()); }
+
+    bool occluded(const ray& r, interval ray_t) const {
+        bool blocked = tree.traverse_any(r, ray_t, [&](uint32_t i, interval& t) {
+            real root;
+            return intersect_sphere(spheres[i].center, spheres[i].radius, r, t, root);
+        });
+        if (blocked) return true;
+        for (const auto& mesh : meshes)
+            if (mesh.triangle_mesh::hit_any(r, ray_t)) return true;
+        return instances.size() > 0 && instances.instance_set::hit_any(r, ray_t);
+    }
+
+    const light_list& lights() const { return scene_lights; }
+
+private:
+    static constexpr uint32_t cache_version = 2; // 2: camera_settings got sky_brightness
+    static constexpr size_t section_alignment = 64;
+    static constexpr char cache_magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+
+    struct cache_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t real_size; // sizeof(real) of the build that wrote it
+        camera_settings camera;
+        uint64_t material_count, material_offset;
+        uint64_t sphere_count, sphere_offset;
+        uint64_t node_count, node_offset;
+    };
+
+    static_assert(std::is_trivially_copyable<cache_header>::value, "cache header is written as raw bytes");
+    static_assert(std::is_trivially_copyable<sphere_record>::value, "spheres are mapped as raw bytes");
+    static_assert(std::is_trivially_copyable<material_record>::value, "materials are mapped as raw bytes");
+
+    mapped_file mapping;
+    const sphere_record* spheres = nullptr;
+    size_t sphere_count = 0;
+    std::vector<material_record> material_records; // kept for write_cache
+    std::vector<static_material> materials;
+    bvh_tree tree;
+    std::vector<triangle_mesh> meshes;
+    instance_set instances;
+    light_list scene_lights;
+
+    void set_materials(const material_record* records, size_t count) {
+        material_records.assign(records, records + count);
+        materials.clear();
+        materials.reserve(count);
+        for (const auto& m : material_records) {
+            switch (m.kind) {
+                case material_kind::metal:
+                    materials.emplace_back(std::in_place_type<metal>, m.albedo, m.fuzz);
+                    break;
+                case material_kind::dielectric:
+                    materials.emplace_back(std::in_place_type<dielectric>, m.refractive_index);
+                    break;
+                case material_kind::light:
+                    materials.emplace_back(std::in_place_type<diffuse_light>, m.albedo);
+                    break;
+                default:
+                    materials.emplace_back(std::in_place_type<lambertian>, m.albedo);
+                    break;
+            }
+        }
+    }
+
+    // the spheres with a light material, looked for only if the scene has one
+    void collect_lights() {
+        scene_lights = light_list();
+        bool has_light = false;
+        for (const auto& m : material_records) has_light = has_light || m.kind == material_kind::light;
+        if (!has_light) return;
+        for (size_t i = 0; i < sphere_count; i++) {
+            const material_record& m = material_records[spheres[i].material_id];
+            if (m.kind == material_kind::light)
+                scene_lights.add(spheres[i].center, spheres[i].radius, spheres[i].material_id, m.albedo);
+        }
+    }
+
+    static std::vector<aabb> sphere_boxes(const sphere_record* records, size_t count) {
+        std::vector<aabb> boxes;
+        boxes.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            vec3 rvec(records[i].radius, records[i].radius, records[i].radius);
+            boxes.push_back(aabb(records[i].center - rvec, records[i].center + rvec));
+        }
+        return boxes;
+    }
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + section_alignment - 1) / section_alignment * section_alignment;
+    }
+
+    bool section_fits(uint64_t offset, uint64_t count, size_t element_size) const {
+        return offset % section_alignment == 0 && offset <= mapping.size() &&
+               count <= (mapping.size() - offset) / element_size;
+    }
+
+    bool bad_cache(const std::string& path, const char* reason) {
+        std::cerr << path << ": " << reason << "\n";
+        mapping.close();
+        spheres = nullptr;
+        sphere_count = 0;
+        tree.use_nodes(nullptr, 0);
+        scene_lights = light_list();
+        return false;
+    }
+};
+
+#endif
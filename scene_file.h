@@ -0,0 +1,434 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "instance.h"
+#include "obj_loader.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// a scene as plain data: camera settings, materials and spheres in flat arrays, no objects
+// and no pointers. it's what the text format below parses into and what the binary scene
+// cache (scene_cache.h) stores as is, so every record has to stay trivially copyable
+
+enum class material_kind : uint32_t { lambertian, metal, dielectric, light };
+
+struct material_record {
+    material_kind kind = material_kind::lambertian;
+    color albedo = color(0.5, 0.5, 0.5); // lambertian and metal, the radiance of a light
+    real fuzz = 0;                       // metal
+    real refractive_index = 1.5;         // dielectric
+};
+
+struct sphere_record {
+    point3 center;
+    real radius = 0;
+    uint32_t material_id = 0; // index into scene_description::materials
+};
+
+// the camera fields a scene file can set, defaults are the ones of main_scene_camera
+struct camera_settings {
+    double aspect_ratio = 16.0 / 9.0;
+    int32_t image_width = 600;
+    int32_t samples_per_pixel = 100;
+    int32_t max_depth = 30;
+    double vfov = 40;
+    point3 lookfrom = point3(6, 5, -3);
+    point3 lookat = point3(0, 0, 0);
+    vec3 vup = vec3(1, 0, 0);
+    double defocus_angle = 0.3;
+    double focus_dist = 8;
+    double sky_brightness = 1;
+
+    void apply(camera& cam) const {
+        cam.aspect_ratio = aspect_ratio;
+        cam.image_width = image_width;
+        cam.samples_per_pixel = samples_per_pixel;
+        cam.max_depth = max_depth;
+        cam.vfov = vfov;
+        cam.lookfrom = lookfrom;
+        cam.lookat = lookat;
+        cam.vup = vup;
+        cam.defocus_angle = defocus_angle;
+        cam.focus_dist = focus_dist;
+        cam.sky_brightness = sky_brightness;
+    }
+};
+
+// animation: what a track moves, and its values at some frames
+enum class track_target : uint32_t { lookfrom, lookat, sphere_center };
+
+struct keyframe {
+    int32_t frame;
+    vec3 value;
+};
+
+struct animation_track {
+    track_target target = track_target::lookfrom;
+    uint32_t sphere_index = 0; // sphere_center only, index into scene_description::spheres
+    std::vector<keyframe> keys; // sorted by frame
+
+    // linear between the keys around frame, the first/last key's value outside of them
+    vec3 at(int frame) const {
+        if (frame <= keys.front().frame) return keys.front().value;
+        for (size_t i = 1; i < keys.size(); i++) {
+            if (frame <= keys[i].frame) {
+                const keyframe& a = keys[i - 1];
+                const keyframe& b = keys[i];
+                real s = real(frame - a.frame) / real(b.frame - a.frame);
+                return (1 - s) * a.value + s * b.value;
+            }
+        }
+        return keys.back().value;
+    }
+};
+
+// a triangle mesh read from an obj file, with the material all its triangles get
+struct mesh_record {
+    mesh_data data;
+    uint32_t material_id = 0;
+};
+
+// one copy of a shared object (scene_description::objects) placed in the world
+struct instance_placement {
+    uint32_t object = 0;
+    affine_transform object_to_world;
+};
+
+struct scene_description {
+    camera_settings camera;
+    std::vector<material_record> materials;
+    std::vector<sphere_record> spheres;
+
+    // meshes, like the tracks, only come from text scenes, a cache holds spheres only
+    std::vector<mesh_record> meshes;
+
+    // meshes that are only drawn through instances, each one stored once however many
+    // instances it has
+    std::vector<mesh_record> objects;
+    std::vector<instance_placement> instances;
+
+    // frames 0 .. frame_count - 1, tracks are only read from text scenes (not cached)
+    int32_t frame_count = 1;
+    std::vector<animation_track> tracks;
+};
+
+// text scene format, one statement per line, '#' starts a comment
+//
+//   image_width 600                      camera settings, same names as the camera fields
+//   aspect_ratio 1.7778                  (image_width samples_per_pixel max_depth
+//   lookfrom 6 5 -3                       aspect_ratio vfov lookfrom lookat vup
+//                                         defocus_angle focus_dist), missing ones keep
+//                                         the defaults above
+//   sky 0.2                              brightness of the sky, 0 for a black background
+//
+//   material ground lambertian 0.05 0.05 0.05     name kind parameters
+//   material chrome metal 0.9 0.9 0.9 0.1         albedo r g b, fuzz
+//   material glass dielectric 1.5                 refractive index
+//   material lamp light 8 7 6                     radiance r g b, spheres with it are
+//                                                 sampled as lights (light.h)
+//
+//   sphere 0 -1000.5 0 1000 ground       center x y z, radius, material name
+//   sphere 0 1 0 1 glass ball            optional name, for animating it
+//
+//   mesh teapot.obj chrome               triangles of an obj file (obj_loader.h), relative
+//                                        paths start at the scene file's directory
+//
+//   object pot teapot.obj chrome         the same, but only drawn through instances
+//   instance pot scale 0.5 rotate y 45 translate 2 0 1
+//                                        a copy of the object moved by these steps, in
+//                                        order: scale s, scale x y z, rotate x|y|z degrees,
+//                                        translate x y z (instance.h)
+//
+// materials have to be defined before the spheres and meshes that use them, objects
+// before their instances. see main.scene, torus.scene and lights.scene
+//
+// animation, see flyby.scene:
+//
+//   frames 48                            number of frames to render
+//   key 0 lookfrom 6 5 -3                camera position at frame 0
+//   key 47 lookat 0 1 0                  camera target at frame 47
+//   key 24 center ball 0 2 0             center of the sphere named ball at frame 24
+//
+// values between keys are interpolated linearly, before the first and after the last key
+// of a track they stay at that key's value. anything without keys stays where the
+// statements above put it
+class scene_text_parser {
+public:
+    bool parse(std::istream& in, const std::string& source_name, scene_description& scene) {
+        scene = scene_description();
+        material_ids.clear();
+        sphere_ids.clear();
+        object_ids.clear();
+        source = source_name;
+
+        std::string text;
+        line_number = 0;
+        while (std::getline(in, text)) {
+            line_number++;
+            auto hash = text.find('#');
+            if (hash != std::string::npos) text.erase(hash);
+
+            std::istringstream line(text);
+            std::string keyword;
+            if (!(line >> keyword)) continue; // empty or comment only
+
+            if (!parse_statement(keyword, line, scene)) return false;
+
+            std::string extra;
+            if (line >> extra) return fail("unexpected '" + extra + "' after " + keyword);
+        }
+        return true;
+    }
+
+private:
+    std::map<std::string, uint32_t> material_ids;
+    std::map<std::string, uint32_t> sphere_ids;
+    std::map<std::string, uint32_t> object_ids;
+    std::string source;
+    int line_number = 0;
+
+    bool fail(const std::string& message) const {
+        std::cerr << source << ":" << line_number << ": " << message << "\n";
+        return false;
+    }
+
+    static bool read_vec3(std::istream& line, vec3& v) {
+        real x, y, z;
+        if (!(line >> x >> y >> z)) return false;
+        v = vec3(x, y, z);
+        return true;
+    }
+
+    bool parse_statement(const std::string& keyword, std::istream& line, scene_description& scene) {
+        camera_settings& cam = scene.camera;
+
+        if (keyword == "material") return parse_material(line, scene);
+        if (keyword == "sphere") return parse_sphere(line, scene);
+        if (keyword == "mesh") return parse_mesh(line, scene.meshes);
+        if (keyword == "object") return parse_object(line, scene);
+        if (keyword == "instance") return parse_instance(line, scene);
+        if (keyword == "key") return parse_key(line, scene);
+
+        bool ok;
+        if (parse_camera_setting(keyword, line, cam, ok)) {}
+        else if (keyword == "frames") ok = bool(line >> scene.frame_count) && scene.frame_count > 0;
+        else return fail("unknown statement '" + keyword + "'");
+
+        return ok ? true : fail("bad value for " + keyword);
+    }
+
+public:
+    // the camera statements, also what render server jobs (render_server.h) set. false if
+    // keyword isn't one of them, otherwise ok tells if its value could be read
+    static bool parse_camera_setting(const std::string& keyword, std::istream& line, camera_settings& cam, bool& ok) {
+        if (keyword == "image_width")            ok = bool(line >> cam.image_width) && cam.image_width > 0;
+        else if (keyword == "samples_per_pixel") ok = bool(line >> cam.samples_per_pixel) && cam.samples_per_pixel > 0;
+        else if (keyword == "max_depth")         ok = bool(line >> cam.max_depth) && cam.max_depth > 0;
+        else if (keyword == "aspect_ratio")      ok = bool(line >> cam.aspect_ratio) && cam.aspect_ratio > 0;
+        else if (keyword == "vfov")              ok = bool(line >> cam.vfov);
+        else if (keyword == "lookfrom")          ok = read_vec3(line, cam.lookfrom);
+        else if (keyword == "lookat")            ok = read_vec3(line, cam.lookat);
+        else if (keyword == "vup")               ok = read_vec3(line, cam.vup);
+        else if (keyword == "defocus_angle")     ok = bool(line >> cam.defocus_angle);
+        else if (keyword == "focus_dist")        ok = bool(line >> cam.focus_dist);
+        else if (keyword == "sky")               ok = bool(line >> cam.sky_brightness) && cam.sky_brightness >= 0;
+        else return false;
+        return true;
+    }
+
+private:
+
+    bool parse_material(std::istream& line, scene_description& scene) {
+        std::string name, kind;
+        if (!(line >> name >> kind)) return fail("material needs a name and a kind");
+        if (material_ids.count(name)) return fail("material '" + name + "' defined twice");
+
+        material_record m;
+        if (kind == "lambertian") {
+            m.kind = material_kind::lambertian;
+            if (!read_vec3(line, m.albedo)) return fail("lambertian needs an albedo r g b");
+        } else if (kind == "metal") {
+            m.kind = material_kind::metal;
+            if (!read_vec3(line, m.albedo) || !(line >> m.fuzz))
+                return fail("metal needs an albedo r g b and a fuzz");
+        } else if (kind == "dielectric") {
+            m.kind = material_kind::dielectric;
+            if (!(line >> m.refractive_index)) return fail("dielectric needs a refractive index");
+        } else if (kind == "light") {
+            m.kind = material_kind::light;
+            if (!read_vec3(line, m.albedo)) return fail("light needs a radiance r g b");
+        } else {
+            return fail("unknown material kind '" + kind + "'");
+        }
+
+        material_ids[name] = uint32_t(scene.materials.size());
+        scene.materials.push_back(m);
+        return true;
+    }
+
+    bool parse_sphere(std::istream& line, scene_description& scene) {
+        sphere_record s;
+        std::string material_name;
+        if (!read_vec3(line, s.center) || !(line >> s.radius >> material_name))
+            return fail("sphere needs a center x y z, a radius and a material");
+
+        auto it = material_ids.find(material_name);
+        if (it == material_ids.end()) return fail("unknown material '" + material_name + "'");
+
+        s.radius = std::fmax(0, s.radius);
+        s.material_id = it->second;
+
+        std::string name;
+        if (line >> name) {
+            if (sphere_ids.count(name)) return fail("sphere '" + name + "' defined twice");
+            sphere_ids[name] = uint32_t(scene.spheres.size());
+        }
+
+        scene.spheres.push_back(s);
+        return true;
+    }
+
+    bool parse_mesh(std::istream& line, std::vector<mesh_record>& to) {
+        std::string path, material_name;
+        if (!(line >> path >> material_name)) return fail("mesh needs an obj file and a material");
+
+        auto it = material_ids.find(material_name);
+        if (it == material_ids.end()) return fail("unknown material '" + material_name + "'");
+
+        auto slash = source.find_last_of('/');
+        if (path[0] != '/' && slash != std::string::npos) path = source.substr(0, slash + 1) + path;
+
+        mesh_record m;
+        m.material_id = it->second;
+        if (!load_obj(path, m.data)) return fail("could not load mesh " + path);
+        to.push_back(std::move(m));
+        return true;
+    }
+
+    bool parse_object(std::istream& line, scene_description& scene) {
+        std::string name;
+        if (!(line >> name)) return fail("object needs a name, an obj file and a material");
+        if (object_ids.count(name)) return fail("object '" + name + "' defined twice");
+        if (!parse_mesh(line, scene.objects)) return false;
+        object_ids[name] = uint32_t(scene.objects.size() - 1);
+        return true;
+    }
+
+    bool parse_instance(std::istream& line, scene_description& scene) {
+        std::string name;
+        if (!(line >> name)) return fail("instance needs an object name");
+        auto it = object_ids.find(name);
+        if (it == object_ids.end()) return fail("unknown object '" + name + "'");
+
+        // the steps are read as words first, scale takes one or three numbers
+        std::vector<std::string> words;
+        std::string word;
+        while (line >> word) words.push_back(word);
+        auto number = [&](size_t i, real& value) {
+            if (i >= words.size()) return false;
+            std::istringstream in(words[i]);
+            return bool(in >> value) && in.eof();
+        };
+
+        affine_transform transform;
+        size_t i = 0;
+        while (i < words.size()) {
+            const std::string& step = words[i];
+            vec3 v;
+            if (step == "translate") {
+                if (!number(i + 1, v[0]) || !number(i + 2, v[1]) || !number(i + 3, v[2]))
+                    return fail("translate needs x y z");
+                transform = affine_transform::translation(v) * transform;
+                i += 4;
+            } else if (step == "scale") {
+                if (!number(i + 1, v[0])) return fail("scale needs s or x y z");
+                if (number(i + 2, v[1])) {
+                    if (!number(i + 3, v[2])) return fail("scale needs s or x y z");
+                    i += 4;
+                } else {
+                    v[1] = v[2] = v[0];
+                    i += 2;
+                }
+                if (v[0] == 0 || v[1] == 0 || v[2] == 0) return fail("scale by 0");
+                transform = affine_transform::scaling(v) * transform;
+            } else if (step == "rotate") {
+                real degrees;
+                std::string axis = i + 1 < words.size() ? words[i + 1] : "";
+                if ((axis != "x" && axis != "y" && axis != "z") || !number(i + 2, degrees))
+                    return fail("rotate needs an axis x, y or z and degrees");
+                transform = affine_transform::rotation(axis[0] - 'x', degrees) * transform;
+                i += 3;
+            } else {
+                return fail("unknown instance step '" + step + "'");
+            }
+        }
+
+        scene.instances.push_back(instance_placement{ it->second, transform });
+        return true;
+    }
+
+    bool parse_key(std::istream& line, scene_description& scene) {
+        int32_t frame;
+        std::string what;
+        if (!(line >> frame >> what) || frame < 0) return fail("key needs a frame number and what it sets");
+
+        track_target target;
+        uint32_t sphere_index = 0;
+        if (what == "lookfrom") {
+            target = track_target::lookfrom;
+        } else if (what == "lookat") {
+            target = track_target::lookat;
+        } else if (what == "center") {
+            std::string name;
+            if (!(line >> name)) return fail("center key needs a sphere name");
+            auto it = sphere_ids.find(name);
+            if (it == sphere_ids.end()) return fail("unknown sphere '" + name + "'");
+            target = track_target::sphere_center;
+            sphere_index = it->second;
+        } else {
+            return fail("can't animate '" + what + "'");
+        }
+
+        keyframe key;
+        key.frame = frame;
+        if (!read_vec3(line, key.value)) return fail("key needs a value x y z");
+
+        animation_track* track = nullptr;
+        for (auto& t : scene.tracks)
+            if (t.target == target && t.sphere_index == sphere_index) track = &t;
+        if (!track) {
+            scene.tracks.emplace_back();
+            track = &scene.tracks.back();
+            track->target = target;
+            track->sphere_index = sphere_index;
+        }
+
+        auto pos = std::lower_bound(track->keys.begin(), track->keys.end(), frame,
+                                    [](const keyframe& k, int32_t f) { return k.frame < f; });
+        if (pos != track->keys.end() && pos->frame == frame) return fail("two keys for the same frame");
+        track->keys.insert(pos, key);
+        return true;
+    }
+};
+
+inline bool load_scene_text(const std::string& path, scene_description& scene) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "could not open " << path << "\n";
+        return false;
+    }
+    return scene_text_parser().parse(file, path, scene);
+}
+
+#endif
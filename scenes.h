@@ -0,0 +1,63 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtweekend.h"
+#include "arena.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+
+// the scene main.cpp renders, it lives here so bench.cpp can measure the exact same thing
+
+// every object is some kind of math equation and solution with a ray and
+// that object gives us points in 3d space where we have to add color
+inline void main_scene(hittable_list& scene_objects, material_table& scene_materials) {
+    // spheres and materials in contiguous blocks, the list and table keep the arena alive
+    scene_arena arena;
+
+    auto matte_ground = scene_materials.add(arena.make<lambertian>(color(0.05, 0.05, 0.05)));
+    scene_objects.add(arena.make<sphere>(point3(0, -1000.5, 0), 1000, matte_ground));
+
+    auto refractive_center = scene_materials.add(arena.make<dielectric>(1.5));
+    scene_objects.add(arena.make<sphere>(point3(0, 1, 0), 1.0, refractive_center));
+
+    auto reflective_purple = scene_materials.add(arena.make<metal>(color(0.6, 0.2, 0.9), 0.0));
+    scene_objects.add(arena.make<sphere>(point3(-2.5, 1.2, -1.5), 1.0, reflective_purple));
+
+    auto reflective_blue = scene_materials.add(arena.make<metal>(color(0.2, 0.8, 1.0), 0.0));
+    scene_objects.add(arena.make<sphere>(point3(2.5, 1.0, -1.0), 1.0, reflective_blue));
+
+    auto floating_mirror = scene_materials.add(arena.make<metal>(color(0.95, 0.95, 0.95), 0.0));
+    scene_objects.add(arena.make<sphere>(point3(0, 3.2, 0.5), 0.7, floating_mirror));
+
+    auto small_glass_orb = scene_materials.add(arena.make<dielectric>(1.5));
+    scene_objects.add(arena.make<sphere>(point3(-2.5, 3.0, -1.5), 0.3, small_glass_orb));
+
+    // There are different types of objects or same objects with differnet properties but they all share same space
+}
+
+// view and quality settings that go with main_scene
+inline void main_scene_camera(camera& main_camera) {
+    main_camera.aspect_ratio      = 16.0 / 9.0;
+    main_camera.image_width       = 600;
+    main_camera.samples_per_pixel = 100;
+    main_camera.max_depth         = 30;
+
+    //VFOV stands for vertical field of view 
+    // lookfrom is from where we are looking generally (0,0,0) but we can override it to change camera direction
+    
+
+    main_camera.vfov     = 40;
+    main_camera.lookfrom = point3(6, 5, -3);      
+    main_camera.lookat   = point3(0, 0, 0);       
+    main_camera.vup      = vec3(1, 0, 0); 
+
+    // vfov,lookfrom and lookat changes the places of camera not its properties 
+    // but defocus changes the properties of camera 
+
+    main_camera.defocus_angle = 0.3;
+    main_camera.focus_dist    = 8.0;
+}
+
+#endif
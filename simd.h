@@ -0,0 +1,153 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "real.h"
+
+// thin wrappers over the sse2/avx2 registers so one kernel can be written for both
+// widths and both precisions. simd_pack<real> holds width lanes, comparisons give a pack
+// with all bits set in the lanes where they're true (a mask), select() blends by mask
+//
+//            double  float
+//   avx2       4       8
+//   sse2       2       4
+//
+// RT_SIMD is defined when one of them is available (sse2 is always there on x86-64)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RT_SIMD 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RT_SIMD 1
+#endif
+
+template <typename T>
+struct simd_pack;
+
+#if defined(__AVX2__)
+
+template <>
+struct simd_pack<double> {
+    static constexpr int width = 4;
+    __m256d v;
+
+    static simd_pack load(const double* p) { return { _mm256_load_pd(p) }; }
+    static simd_pack set1(double x) { return { _mm256_set1_pd(x) }; }
+    static simd_pack lane_index() { return { _mm256_setr_pd(0, 1, 2, 3) }; }
+    void store(double* p) const { _mm256_store_pd(p, v); }
+
+    friend simd_pack operator+(simd_pack a, simd_pack b) { return { _mm256_add_pd(a.v, b.v) }; }
+    friend simd_pack operator-(simd_pack a, simd_pack b) { return { _mm256_sub_pd(a.v, b.v) }; }
+    friend simd_pack operator*(simd_pack a, simd_pack b) { return { _mm256_mul_pd(a.v, b.v) }; }
+    friend simd_pack operator/(simd_pack a, simd_pack b) { return { _mm256_div_pd(a.v, b.v) }; }
+    friend simd_pack operator<(simd_pack a, simd_pack b) { return { _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ) }; }
+    friend simd_pack operator>(simd_pack a, simd_pack b) { return { _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ) }; }
+    friend simd_pack operator>=(simd_pack a, simd_pack b) { return { _mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ) }; }
+    friend simd_pack operator&(simd_pack a, simd_pack b) { return { _mm256_and_pd(a.v, b.v) }; }
+    friend simd_pack operator|(simd_pack a, simd_pack b) { return { _mm256_or_pd(a.v, b.v) }; }
+
+    friend simd_pack sqrt(simd_pack a) { return { _mm256_sqrt_pd(a.v) }; }
+    friend simd_pack max(simd_pack a, simd_pack b) { return { _mm256_max_pd(a.v, b.v) }; }
+    friend simd_pack select(simd_pack mask, simd_pack if_true, simd_pack if_false) {
+        return { _mm256_blendv_pd(if_false.v, if_true.v, mask.v) };
+    }
+    friend bool any(simd_pack mask) { return _mm256_movemask_pd(mask.v) != 0; }
+};
+
+template <>
+struct simd_pack<float> {
+    static constexpr int width = 8;
+    __m256 v;
+
+    static simd_pack load(const float* p) { return { _mm256_load_ps(p) }; }
+    static simd_pack set1(float x) { return { _mm256_set1_ps(x) }; }
+    static simd_pack lane_index() { return { _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7) }; }
+    void store(float* p) const { _mm256_store_ps(p, v); }
+
+    friend simd_pack operator+(simd_pack a, simd_pack b) { return { _mm256_add_ps(a.v, b.v) }; }
+    friend simd_pack operator-(simd_pack a, simd_pack b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    friend simd_pack operator*(simd_pack a, simd_pack b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    friend simd_pack operator/(simd_pack a, simd_pack b) { return { _mm256_div_ps(a.v, b.v) }; }
+    friend simd_pack operator<(simd_pack a, simd_pack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    friend simd_pack operator>(simd_pack a, simd_pack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    friend simd_pack operator>=(simd_pack a, simd_pack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+    friend simd_pack operator&(simd_pack a, simd_pack b) { return { _mm256_and_ps(a.v, b.v) }; }
+    friend simd_pack operator|(simd_pack a, simd_pack b) { return { _mm256_or_ps(a.v, b.v) }; }
+
+    friend simd_pack sqrt(simd_pack a) { return { _mm256_sqrt_ps(a.v) }; }
+    friend simd_pack max(simd_pack a, simd_pack b) { return { _mm256_max_ps(a.v, b.v) }; }
+    friend simd_pack select(simd_pack mask, simd_pack if_true, simd_pack if_false) {
+        return { _mm256_blendv_ps(if_false.v, if_true.v, mask.v) };
+    }
+    friend bool any(simd_pack mask) { return _mm256_movemask_ps(mask.v) != 0; }
+};
+
+inline const char* simd_name() { return "avx2"; }
+
+#elif defined(__SSE2__)
+
+// sse2 has no blend, select(mask, a, b) = (mask & a) | (~mask & b)
+template <>
+struct simd_pack<double> {
+    static constexpr int width = 2;
+    __m128d v;
+
+    static simd_pack load(const double* p) { return { _mm_load_pd(p) }; }
+    static simd_pack set1(double x) { return { _mm_set1_pd(x) }; }
+    static simd_pack lane_index() { return { _mm_setr_pd(0, 1) }; }
+    void store(double* p) const { _mm_store_pd(p, v); }
+
+    friend simd_pack operator+(simd_pack a, simd_pack b) { return { _mm_add_pd(a.v, b.v) }; }
+    friend simd_pack operator-(simd_pack a, simd_pack b) { return { _mm_sub_pd(a.v, b.v) }; }
+    friend simd_pack operator*(simd_pack a, simd_pack b) { return { _mm_mul_pd(a.v, b.v) }; }
+    friend simd_pack operator/(simd_pack a, simd_pack b) { return { _mm_div_pd(a.v, b.v) }; }
+    friend simd_pack operator<(simd_pack a, simd_pack b) { return { _mm_cmplt_pd(a.v, b.v) }; }
+    friend simd_pack operator>(simd_pack a, simd_pack b) { return { _mm_cmpgt_pd(a.v, b.v) }; }
+    friend simd_pack operator>=(simd_pack a, simd_pack b) { return { _mm_cmpge_pd(a.v, b.v) }; }
+    friend simd_pack operator&(simd_pack a, simd_pack b) { return { _mm_and_pd(a.v, b.v) }; }
+    friend simd_pack operator|(simd_pack a, simd_pack b) { return { _mm_or_pd(a.v, b.v) }; }
+
+    friend simd_pack sqrt(simd_pack a) { return { _mm_sqrt_pd(a.v) }; }
+    friend simd_pack max(simd_pack a, simd_pack b) { return { _mm_max_pd(a.v, b.v) }; }
+    friend simd_pack select(simd_pack mask, simd_pack if_true, simd_pack if_false) {
+        return { _mm_or_pd(_mm_and_pd(mask.v, if_true.v), _mm_andnot_pd(mask.v, if_false.v)) };
+    }
+    friend bool any(simd_pack mask) { return _mm_movemask_pd(mask.v) != 0; }
+};
+
+template <>
+struct simd_pack<float> {
+    static constexpr int width = 4;
+    __m128 v;
+
+    static simd_pack load(const float* p) { return { _mm_load_ps(p) }; }
+    static simd_pack set1(float x) { return { _mm_set1_ps(x) }; }
+    static simd_pack lane_index() { return { _mm_setr_ps(0, 1, 2, 3) }; }
+    void store(float* p) const { _mm_store_ps(p, v); }
+
+    friend simd_pack operator+(simd_pack a, simd_pack b) { return { _mm_add_ps(a.v, b.v) }; }
+    friend simd_pack operator-(simd_pack a, simd_pack b) { return { _mm_sub_ps(a.v, b.v) }; }
+    friend simd_pack operator*(simd_pack a, simd_pack b) { return { _mm_mul_ps(a.v, b.v) }; }
+    friend simd_pack operator/(simd_pack a, simd_pack b) { return { _mm_div_ps(a.v, b.v) }; }
+    friend simd_pack operator<(simd_pack a, simd_pack b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+    friend simd_pack operator>(simd_pack a, simd_pack b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+    friend simd_pack operator>=(simd_pack a, simd_pack b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+    friend simd_pack operator&(simd_pack a, simd_pack b) { return { _mm_and_ps(a.v, b.v) }; }
+    friend simd_pack operator|(simd_pack a, simd_pack b) { return { _mm_or_ps(a.v, b.v) }; }
+
+    friend simd_pack sqrt(simd_pack a) { return { _mm_sqrt_ps(a.v) }; }
+    friend simd_pack max(simd_pack a, simd_pack b) { return { _mm_max_ps(a.v, b.v) }; }
+    friend simd_pack select(simd_pack mask, simd_pack if_true, simd_pack if_false) {
+        return { _mm_or_ps(_mm_and_ps(mask.v, if_true.v), _mm_andnot_ps(mask.v, if_false.v)) };
+    }
+    friend bool any(simd_pack mask) { return _mm_movemask_ps(mask.v) != 0; }
+};
+
+inline const char* simd_name() { return "sse2"; }
+
+#else
+
+inline const char* simd_name() { return "scalar"; }
+
+#endif
+
+#endif
@@ -2,47 +2,96 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "stats.h"
 #include "vec3.h"
 
+// how far a ray leaving p has to start off the sphere so the next hit test can't find the
+// same surface again. besides the error of p itself this covers the rounding in the
+// quadratic of hit(): oc = center - origin is only as exact as the bigger of the two
+// coordinates, and c = |oc|^2 - r^2 loses a few ulps of r^2, which is what makes big
+// spheres (the ground, r = 1000) the first to show acne
+inline vec3 sphere_point_error(const point3& center, real radius, const point3& p) {
+    return rounding_error(8) * (abs(center) + abs(p) + vec3(radius, radius, radius));
+}
+
+// the sphere math on its own, shared by sphere and the containers that store spheres as
+// plain data (static_scene, flat_scene) so they don't need a sphere object per primitive
+
+// closest root of the ray/sphere quadratic inside ray_t
+inline bool intersect_sphere(const point3& center, real radius, const ray& r, interval ray_t, real& root) {
+    RT_STAT_INC(sphere_tests);
+    vec3 oc = center - r.origin();
+    auto a = r.direction().length_squared();
+    auto half_b = dot(r.direction(), oc);
+    auto c = oc.length_squared() - radius * radius;
+
+    auto discriminant = half_b * half_b - a * c;
+    if (discriminant < 0) return false;
+
+    auto sqrtd = std::sqrt(discriminant);
+
+    // find closest root in valid interval
+    root = (half_b - sqrtd) / a;
+    if (!ray_t.surrounds(root)) {
+        root = (half_b + sqrtd) / a;
+        if (!ray_t.surrounds(root))
+            return false;
+    }
+    RT_STAT_INC(sphere_hits);
+    return true;
+}
+
+// fills point, error bound, normal and material of a hit at rec.hit_t
+inline void sphere_surface(const point3& center, real radius, uint32_t material_id,
+                           const ray& r, hit_record& rec) {
+    // r.at() is off by however much error hit_t has, projecting the point back onto the
+    // sphere leaves only the few roundings of this line
+    vec3 from_center = r.at(rec.hit_t) - center;
+    vec3 outward_normal = from_center / from_center.length();
+    rec.hit_point = center + radius * outward_normal;
+    rec.point_error = sphere_point_error(center, radius, rec.hit_point);
+    rec.set_face_normal(r, outward_normal);
+    rec.material_id = material_id;
+}
+
 class sphere : public hittable {
 public:
     // full constructor with center, radius, and material
-    sphere(const point3& c, double r, shared_ptr<material> m)
-        : center(c), radius(std::fmax(0, r)), surface_material(m) {}
+    // material_id is the index returned by material_table::add
+    sphere(const point3& c, real r, uint32_t material_id)
+        : center(c), radius(std::fmax(0, r)), material_id(material_id)
+    {
+        auto rvec = vec3(radius, radius, radius);
+        bbox = aabb(center - rvec, center + rvec);
+    }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        vec3 oc = center - r.origin();
-        auto a = r.direction().length_squared();
-        auto half_b = dot(r.direction(), oc);
-        auto c = oc.length_squared() - radius * radius;
-
-        auto discriminant = half_b * half_b - a * c;
-        if (discriminant < 0) return false;
-
-        auto sqrtd = sqrt(discriminant);
-
-        // find closest root in valid interval
-        auto root = (half_b - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (half_b + sqrtd) / a;
-            if (!ray_t.surrounds(root))
-                return false;
-        }
+        real root;
+        if (!intersect_sphere(center, radius, r, ray_t, root)) return false;
 
-        // fill hit record
+        // only the distance and who was hit, the rest waits for compute_surface
         rec.hit_t = root;
-        rec.hit_point = r.at(rec.hit_t);
-        vec3 outward_normal = (rec.hit_point - center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        rec.surface_material = surface_material;
+        rec.hit_object = this;
+        rec.primitive_index = 0;
 
         return true;
     }
 
+    void compute_surface(const ray& r, hit_record& rec) const override {
+        sphere_surface(center, radius, material_id, r, rec);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    const point3& sphere_center() const { return center; }
+    real sphere_radius() const { return radius; }
+    uint32_t sphere_material() const { return material_id; }
+
 private:
     point3 center;
-    double radius;
-    shared_ptr<material> surface_material;
+    real radius;
+    uint32_t material_id;
+    aabb bbox;
 };
 
 #endif
@@ -0,0 +1,202 @@
+#ifndef SPHERE_SOA_H
+#define SPHERE_SOA_H
+
+#include "aligned_vector.h"
+#include "hittable.h"
+#include "simd.h"
+#include "sphere.h"
+#include "stats.h"
+#include "vec3.h"
+
+#include <cstdint>
+#include <vector>
+
+// many spheres stored as a structure of arrays: all x of the centers next to each other,
+// then all y, and so on. this way the simd kernel can load a whole register of spheres
+// with one instruction and test one ray against all of them at once: 4 (avx2) or 2 (sse2)
+// with double, twice that in the float build
+//
+// build with -mavx2 (or -march=native) to get the avx2 kernel, otherwise sse2 is used
+class sphere_soa : public hittable {
+public:
+    sphere_soa() {}
+
+    void add(const point3& center, real radius, uint32_t material_id) {
+        radius = std::fmax(0, radius);
+        center_x.push_back(center.x());
+        center_y.push_back(center.y());
+        center_z.push_back(center.z());
+        radii.push_back(radius);
+        radius_squared.push_back(radius * radius);
+        material_ids.push_back(material_id);
+
+        auto rvec = vec3(radius, radius, radius);
+        bbox = aabb(bbox, aabb(center - rvec, center + rvec));
+    }
+
+    size_t size() const { return radii.size(); }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        real t;
+        int index = closest_hit(r, ray_t, t);
+        if (index < 0) return false;
+
+        rec.hit_t = t;
+        rec.hit_object = this;
+        rec.primitive_index = uint32_t(index);
+        return true;
+    }
+
+    void compute_surface(const ray& r, hit_record& rec) const override {
+        uint32_t i = rec.primitive_index;
+        point3 center(center_x[i], center_y[i], center_z[i]);
+        sphere_surface(center, radii[i], material_ids[i], r, rec);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    // index of the closest sphere hit inside ray_t (and its t), -1 if nothing is hit
+    // (only the tests are counted in the stats, the kernels never know which lanes hit)
+    int closest_hit(const ray& r, const interval& ray_t, real& closest_t) const {
+        RT_STAT_ADD(sphere_tests, size());
+#if defined(RT_SIMD)
+        return closest_hit_simd(r, ray_t, closest_t);
+#else
+        return closest_hit_scalar(r, ray_t, closest_t, 0);
+#endif
+    }
+
+    // plain one sphere at a time version of the same test, also handles the leftover
+    // spheres at the end that don't fill a whole simd register
+    int closest_hit_scalar(const ray& r, const interval& ray_t, real& closest_t, size_t first) const {
+        const point3& o = r.origin();
+        const vec3& d = r.direction();
+        real a = d.length_squared();
+
+        int best = -1;
+        real t_max = ray_t.max;
+        for (size_t i = first; i < size(); i++) {
+            real ocx = center_x[i] - o.x(), ocy = center_y[i] - o.y(), ocz = center_z[i] - o.z();
+            real half_b = d.x() * ocx + d.y() * ocy + d.z() * ocz;
+            real c = ocx * ocx + ocy * ocy + ocz * ocz - radius_squared[i];
+            real discriminant = half_b * half_b - a * c;
+            if (discriminant < 0) continue;
+
+            real sqrtd = std::sqrt(discriminant);
+            real root = (half_b - sqrtd) / a;
+            if (!(ray_t.min < root && root < t_max)) {
+                root = (half_b + sqrtd) / a;
+                if (!(ray_t.min < root && root < t_max)) continue;
+            }
+            t_max = root;
+            best = int(i);
+        }
+
+        if (best >= 0) closest_t = t_max;
+        return best;
+    }
+
+    // name of the kernel closest_hit() uses, for benchmark output
+    static const char* kernel_name() { return simd_name(); }
+
+private:
+    aligned_vector<real> center_x, center_y, center_z;
+    aligned_vector<real> radius_squared;
+    std::vector<real> radii;
+    std::vector<uint32_t> material_ids;
+    aabb bbox;
+
+    // picks the better of the simd result and the scalar tail
+    int merge_tail(const ray& r, const interval& ray_t, size_t tail_start,
+                   int best, real best_t, real& closest_t) const {
+        real tail_t;
+        int tail = closest_hit_scalar(r, interval(ray_t.min, best >= 0 ? best_t : ray_t.max),
+                                      tail_t, tail_start);
+        if (tail >= 0) {
+            closest_t = tail_t;
+            return tail;
+        }
+        if (best >= 0) closest_t = best_t;
+        return best;
+    }
+
+#if defined(RT_SIMD)
+    int closest_hit_simd(const ray& r, const interval& ray_t, real& closest_t) const {
+        using pack = simd_pack<real>;
+        constexpr int width = pack::width;
+
+        const pack ox = pack::set1(r.origin().x());
+        const pack oy = pack::set1(r.origin().y());
+        const pack oz = pack::set1(r.origin().z());
+        const pack dx = pack::set1(r.direction().x());
+        const pack dy = pack::set1(r.direction().y());
+        const pack dz = pack::set1(r.direction().z());
+        const pack a = pack::set1(r.direction().length_squared());
+        const pack t_min = pack::set1(ray_t.min);
+        const pack inf = pack::set1(infinity);
+        const pack zero = pack::set1(0);
+
+        // every lane keeps its own closest t and index, they get reduced at the end.
+        // indices are kept as real so they can be blended like t (exact up to 2^24 in float)
+        pack best_t = pack::set1(ray_t.max);
+        pack best_index = pack::set1(-1);
+        pack index = pack::lane_index();
+        const pack step = pack::set1(real(width));
+
+        size_t n = size() - size() % width;
+        for (size_t i = 0; i < n; i += width) {
+            pack ocx = pack::load(&center_x[i]) - ox;
+            pack ocy = pack::load(&center_y[i]) - oy;
+            pack ocz = pack::load(&center_z[i]) - oz;
+
+            // sums in the same order as the scalar code so both give the same t
+            pack half_b = (dx * ocx + dy * ocy) + dz * ocz;
+            pack c = (ocx * ocx + ocy * ocy) + ocz * ocz - pack::load(&radius_squared[i]);
+            pack discriminant = half_b * half_b - a * c;
+            pack has_root = discriminant >= zero;
+            if (!any(has_root)) {
+                index = index + step;
+                continue;
+            }
+
+            pack sqrtd = sqrt(max(discriminant, zero));
+            pack near_root = (half_b - sqrtd) / a;
+            pack far_root = (half_b + sqrtd) / a;
+
+            // same rule as sphere::hit, near root if it's inside the interval else the far one
+            pack near_ok = (near_root > t_min) & (near_root < best_t);
+            pack far_ok = (far_root > t_min) & (far_root < best_t);
+            pack root = select(near_ok, near_root, select(far_ok, far_root, inf));
+            pack closer = has_root & (near_ok | far_ok);
+
+            best_t = select(closer, root, best_t);
+            best_index = select(closer, index, best_index);
+            index = index + step;
+        }
+
+        alignas(32) real lane_t[width];
+        alignas(32) real lane_index[width];
+        best_t.store(lane_t);
+        best_index.store(lane_index);
+        return reduce_lanes(r, ray_t, lane_t, lane_index, width, n, closest_t);
+    }
+#endif
+
+    // closest of the per lane results, ties go to the lower index like the scalar loop
+    int reduce_lanes(const ray& r, const interval& ray_t, const real* lane_t, const real* lane_index,
+                     int lanes, size_t tail_start, real& closest_t) const {
+        int best = -1;
+        real best_t = ray_t.max;
+        for (int l = 0; l < lanes; l++) {
+            if (lane_index[l] < 0) continue;
+            int idx = int(lane_index[l]);
+            if (lane_t[l] < best_t || (lane_t[l] == best_t && idx < best)) {
+                best_t = lane_t[l];
+                best = idx;
+            }
+        }
+        return merge_tail(r, ray_t, tail_start, best, best_t, closest_t);
+    }
+};
+
+#endif
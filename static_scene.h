@@ -0,0 +1,169 @@
+#ifndef STATIC_SCENE_H
+#define STATIC_SCENE_H
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "light.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <type_traits>
+#include <typeinfo>
+#include <variant>
+#include <vector>
+
+// closed sets of the built in materials and primitives
+using static_material = std::variant<lambertian, metal, dielectric, diffuse_light>;
+using static_primitive = std::variant<sphere>;
+
+// a scene stored by value in variants instead of behind shared_ptr<hittable>/<material>
+// std::visit turns every call into a switch over a known set of types and the qualified
+// T::hit / T::scatter calls inside it are direct calls, so the compiler can inline the
+// sphere and material math into the render loop
+//
+// the virtual hittable/material classes stay the way to add your own kinds of objects,
+// this only covers scenes made of the built in ones. camera::render takes it like a
+// virtual_scene
+class static_scene {
+public:
+    uint32_t add_material(const static_material& m) {
+        materials.push_back(m);
+        return uint32_t(materials.size() - 1);
+    }
+
+    // call build_bvh() after the last primitive is added
+    void add(const static_primitive& p) { primitives.push_back(p); }
+
+    size_t size() const { return primitives.size(); }
+
+    // copies a scene built from the virtual classes, the list has to hold the objects
+    // themselves (not a bvh_node around them). returns false if any object or material
+    // is not one of the built in types. the types have to match exactly: a subclass of
+    // lambertian copied as a lambertian would lose its own scatter and evaluate
+    static bool from_virtual(const hittable_list& list, const material_table& table, static_scene& out) {
+        out = static_scene();
+
+        for (size_t id = 0; id < table.size(); id++) {
+            const material& m = table[uint32_t(id)];
+            const std::type_info& type = typeid(m);
+            if (type == typeid(lambertian))
+                out.materials.emplace_back(std::in_place_type<lambertian>, static_cast<const lambertian&>(m));
+            else if (type == typeid(metal))
+                out.materials.emplace_back(std::in_place_type<metal>, static_cast<const metal&>(m));
+            else if (type == typeid(dielectric))
+                out.materials.emplace_back(std::in_place_type<dielectric>, static_cast<const dielectric&>(m));
+            else if (type == typeid(diffuse_light))
+                out.materials.emplace_back(std::in_place_type<diffuse_light>, static_cast<const diffuse_light&>(m));
+            else
+                return false;
+        }
+
+        for (const auto& obj : list.objects) {
+            if (obj && typeid(*obj) == typeid(sphere))
+                out.primitives.emplace_back(std::in_place_type<sphere>, static_cast<const sphere&>(*obj));
+            else
+                return false;
+        }
+
+        out.scene_lights = find_lights(list, table);
+        out.build_bvh();
+        return true;
+    }
+
+    void build_bvh() {
+        std::vector<aabb> boxes;
+        boxes.reserve(primitives.size());
+        for (const auto& p : primitives)
+            boxes.push_back(std::visit([](const auto& prim) { return prim.bounding_box(); }, p));
+
+        std::vector<static_primitive> ordered;
+        ordered.reserve(primitives.size());
+        for (uint32_t index : tree.build(boxes))
+            ordered.push_back(primitives[index]);
+        primitives = std::move(ordered);
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const {
+        bool any_hit = tree.traverse(r, ray_t, [&](uint32_t i, interval& t) {
+            bool hit = std::visit([&](const auto& prim) {
+                using T = std::decay_t<decltype(prim)>;
+                return prim.T::hit(r, t, rec);
+            }, primitives[i]);
+            if (!hit) return false;
+            rec.primitive_index = i;
+            t.max = rec.hit_t;
+            return true;
+        });
+        if (!any_hit) return false;
+
+        std::visit([&](const auto& prim) {
+            using T = std::decay_t<decltype(prim)>;
+            prim.T::compute_surface(r, rec);
+        }, primitives[rec.primitive_index]);
+        return true;
+    }
+
+    bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::scatter(r, rec, attenuation, scattered);
+        }, materials[rec.material_id]);
+    }
+
+    color emitted(const ray& r, const hit_record& rec) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::emitted(r, rec);
+        }, materials[rec.material_id]);
+    }
+
+    color evaluate(const ray& r, const hit_record& rec, const vec3& dir, real& pdf) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::evaluate(r, rec, dir, pdf);
+        }, materials[rec.material_id]);
+    }
+
+    bool has_pdf(const hit_record& rec) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::has_pdf();
+        }, materials[rec.material_id]);
+    }
+
+    bool is_mirror(const hit_record& rec) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::is_mirror();
+        }, materials[rec.material_id]);
+    }
+
+    color base_color(const hit_record& rec) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            return m.T::base_color(rec);
+        }, materials[rec.material_id]);
+    }
+
+    uint32_t material_type(const hit_record& rec) const { return uint32_t(materials[rec.material_id].index()); }
+
+    bool occluded(const ray& r, interval ray_t) const {
+        return tree.traverse_any(r, ray_t, [&](uint32_t i, interval& t) {
+            hit_record rec;
+            return std::visit([&](const auto& prim) {
+                using T = std::decay_t<decltype(prim)>;
+                return prim.T::hit(r, t, rec);
+            }, primitives[i]);
+        });
+    }
+
+    const light_list& lights() const { return scene_lights; }
+
+private:
+    std::vector<static_primitive> primitives;
+    std::vector<static_material> materials;
+    bvh_tree tree;
+    light_list scene_lights;
+};
+
+#endif
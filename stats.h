@@ -0,0 +1,224 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// render statistics: ray counts, intersection tests, scatter calls, how paths end and
+// how long tiles take. build with -DRT_STATS to collect them, without it every RT_STAT_*
+// macro below is empty so the hot paths are exactly what they were
+//
+// every thread counts into its own render_stats (no atomics, no shared cache lines),
+// stats_registry keeps them all alive past the end of the thread and adds them up when
+// somebody asks, which should only be after the render is done
+
+#ifdef RT_STATS
+constexpr bool stats_enabled = true;
+#else
+constexpr bool stats_enabled = false;
+#endif
+
+// why a path stopped bouncing
+enum class path_end { missed, absorbed, max_depth, roulette, count };
+
+struct render_stats {
+    // bounces are counted up to this, longer paths land in the last bin
+    static constexpr int depth_bins = 64;
+
+    uint64_t primary_rays = 0;
+    uint64_t secondary_rays = 0;
+    uint64_t shadow_rays = 0; // towards sampled lights, any hit only
+
+    uint64_t list_hit_calls = 0; // hittable_list::hit
+    uint64_t bvh_node_tests = 0; // boxes tested while walking a bvh_tree
+    uint64_t sphere_tests = 0;   // ray/sphere quadratics, scalar or simd lanes
+    uint64_t sphere_hits = 0;    // of those, the ones with a root inside the interval
+    uint64_t triangle_tests = 0; // watertight ray/triangle tests of triangle_mesh
+    uint64_t triangle_hits = 0;
+
+    uint64_t lambertian_scatters = 0;
+    uint64_t metal_scatters = 0;
+    uint64_t dielectric_scatters = 0;
+
+    uint64_t path_ends[int(path_end::count)] = {};
+    uint64_t path_depth[depth_bins] = {}; // paths by the number of bounces they made
+
+    uint64_t tiles = 0; // tiles, or scanlines when rendering with one thread
+    double busy_seconds = 0;
+    double max_tile_seconds = 0;
+
+    void end_path(path_end reason, int bounces) {
+        path_ends[int(reason)]++;
+        path_depth[bounces < depth_bins ? (bounces < 0 ? 0 : bounces) : depth_bins - 1]++;
+    }
+
+    void add_tile(double seconds) {
+        tiles++;
+        busy_seconds += seconds;
+        if (seconds > max_tile_seconds) max_tile_seconds = seconds;
+    }
+
+    render_stats& operator+=(const render_stats& other) {
+        primary_rays += other.primary_rays;
+        secondary_rays += other.secondary_rays;
+        shadow_rays += other.shadow_rays;
+        list_hit_calls += other.list_hit_calls;
+        bvh_node_tests += other.bvh_node_tests;
+        sphere_tests += other.sphere_tests;
+        sphere_hits += other.sphere_hits;
+        triangle_tests += other.triangle_tests;
+        triangle_hits += other.triangle_hits;
+        lambertian_scatters += other.lambertian_scatters;
+        metal_scatters += other.metal_scatters;
+        dielectric_scatters += other.dielectric_scatters;
+        for (int i = 0; i < int(path_end::count); i++) path_ends[i] += other.path_ends[i];
+        for (int i = 0; i < depth_bins; i++) path_depth[i] += other.path_depth[i];
+        tiles += other.tiles;
+        busy_seconds += other.busy_seconds;
+        if (other.max_tile_seconds > max_tile_seconds) max_tile_seconds = other.max_tile_seconds;
+        return *this;
+    }
+};
+
+class stats_registry {
+public:
+    static stats_registry& instance() {
+        static stats_registry registry;
+        return registry;
+    }
+
+    // a new block for the calling thread, owned by the registry so it outlives the thread
+    // (the pool's workers are gone by the time anyone reads the numbers)
+    render_stats* add_thread() {
+        std::lock_guard<std::mutex> lock(mutex);
+        blocks.push_back(std::make_unique<render_stats>());
+        return blocks.back().get();
+    }
+
+    // copies of every thread's block, in the order the threads first counted something
+    std::vector<render_stats> per_thread() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<render_stats> copies;
+        for (const auto& block : blocks) copies.push_back(*block);
+        return copies;
+    }
+
+    render_stats merged() const {
+        render_stats total;
+        for (const auto& block : per_thread()) total += block;
+        return total;
+    }
+
+    // zeroes the blocks instead of dropping them, live threads still point at theirs
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& block : blocks) *block = render_stats();
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<render_stats>> blocks;
+};
+
+// the calling thread's block, registered on first use. a plain null pointer instead of a
+// thread_local with an initializer, that one would go through a guard on every access
+inline thread_local render_stats* local_stats = nullptr;
+
+inline render_stats& thread_stats() {
+    if (!local_stats) local_stats = stats_registry::instance().add_thread();
+    return *local_stats;
+}
+
+// times one tile (or scanline) into the calling thread's block when it goes out of scope
+class stats_tile_timer {
+public:
+    stats_tile_timer() : start(std::chrono::steady_clock::now()) {}
+    ~stats_tile_timer() {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        thread_stats().add_tile(elapsed.count());
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifdef RT_STATS
+#define RT_STAT_ADD(field, n) (thread_stats().field += (n))
+#define RT_STAT_PATH_END(reason, bounces) thread_stats().end_path(path_end::reason, (bounces))
+#define RT_STAT_TILE_TIMER() stats_tile_timer rt_stat_tile_timer
+#else
+#define RT_STAT_ADD(field, n) ((void)sizeof(n)) // n is not evaluated, only keeps it "used"
+#define RT_STAT_PATH_END(reason, bounces) ((void)0)
+#define RT_STAT_TILE_TIMER() ((void)0)
+#endif
+
+#define RT_STAT_INC(field) RT_STAT_ADD(field, 1)
+
+// everything the registry has as json: totals first, then one entry per thread.
+// path_depth[i] is the number of paths that ended after i bounces, trailing zeros cut
+inline bool write_stats_json(const std::string& path, double render_seconds) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "could not open " << path << " for writing\n";
+        return false;
+    }
+
+    auto threads = stats_registry::instance().per_thread();
+    render_stats total;
+    for (const auto& t : threads) total += t;
+
+    const char* end_names[] = { "missed", "absorbed", "max_depth", "roulette" };
+    static_assert(sizeof(end_names) / sizeof(end_names[0]) == int(path_end::count), "one name per path_end");
+
+    char line[256];
+    uint64_t rays = total.primary_rays + total.secondary_rays;
+    out << "{\n";
+    std::snprintf(line, sizeof(line), "  \"render_s\": %.6g,\n  \"rays_per_s\": %.6g,\n", render_seconds,
+                  render_seconds > 0 ? rays / render_seconds : 0.0);
+    out << line;
+    out << "  \"primary_rays\": " << total.primary_rays << ",\n"
+        << "  \"secondary_rays\": " << total.secondary_rays << ",\n"
+        << "  \"shadow_rays\": " << total.shadow_rays << ",\n"
+        << "  \"hittable_list_hit_calls\": " << total.list_hit_calls << ",\n"
+        << "  \"bvh_node_tests\": " << total.bvh_node_tests << ",\n"
+        << "  \"sphere_tests\": " << total.sphere_tests << ",\n"
+        << "  \"sphere_hits\": " << total.sphere_hits << ",\n"
+        << "  \"triangle_tests\": " << total.triangle_tests << ",\n"
+        << "  \"triangle_hits\": " << total.triangle_hits << ",\n"
+        << "  \"scatter\": {\"lambertian\": " << total.lambertian_scatters
+        << ", \"metal\": " << total.metal_scatters
+        << ", \"dielectric\": " << total.dielectric_scatters << "},\n";
+
+    out << "  \"path_ends\": {";
+    for (int i = 0; i < int(path_end::count); i++)
+        out << (i ? ", " : "") << "\"" << end_names[i] << "\": " << total.path_ends[i];
+    out << "},\n";
+
+    int used_bins = render_stats::depth_bins;
+    while (used_bins > 1 && total.path_depth[used_bins - 1] == 0) used_bins--;
+    out << "  \"path_depth\": [";
+    for (int i = 0; i < used_bins; i++) out << (i ? ", " : "") << total.path_depth[i];
+    out << "],\n";
+
+    out << "  \"threads\": [\n";
+    for (size_t i = 0; i < threads.size(); i++) {
+        const auto& t = threads[i];
+        std::snprintf(line, sizeof(line),
+                      "    {\"tiles\": %llu, \"busy_s\": %.6g, \"max_tile_s\": %.6g, \"rays\": %llu}%s\n",
+                      (unsigned long long)t.tiles, t.busy_seconds, t.max_tile_seconds,
+                      (unsigned long long)(t.primary_rays + t.secondary_rays),
+                      i + 1 < threads.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+    return bool(out);
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// small work stealing pool, every worker owns a queue of task indices
+// and when its own queue runs dry it steals from the back of the others
+// so a slow tile (glass, lots of bounces) doesn't leave the rest idle
+class thread_pool {
+public:
+    explicit thread_pool(int thread_count = 0) {
+        if (thread_count <= 0) thread_count = default_thread_count();
+
+        for (int i = 0; i < thread_count; i++)
+            queues.push_back(std::make_unique<work_queue>());
+        for (int i = 0; i < thread_count; i++)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return int(workers.size()); }
+
+    static int default_thread_count() {
+        unsigned hw = std::thread::hardware_concurrency();
+        return hw == 0 ? 1 : int(hw);
+    }
+
+    // runs task(i) for every i in [0, task_count) and blocks until all are done
+    void parallel_for(int task_count, const std::function<void(int)>& task) {
+        if (task_count <= 0) return;
+
+        std::lock_guard<std::mutex> batch_lock(batch_mutex); // one batch at a time
+
+        // task pointer is published before any index is queued, a worker only reads it
+        // after popping an index so the queue mutex orders the two
+        current_task = &task;
+        remaining.store(task_count);
+
+        // neighbouring indices go to the same worker so tiles next to each other
+        // share cache lines of the scene, stealing only kicks in near the end
+        int queue_count = size();
+        for (int i = 0; i < task_count; i++) {
+            auto& q = *queues[size_t(i) * queue_count / task_count];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(i);
+        }
+
+        std::unique_lock<std::mutex> lock(state_mutex);
+        generation++;
+        wake.notify_all();
+        done.wait(lock, [this] { return remaining.load() == 0; });
+        current_task = nullptr;
+    }
+
+private:
+    struct work_queue {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    std::vector<std::unique_ptr<work_queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex batch_mutex;
+    std::mutex state_mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* current_task = nullptr;
+    std::atomic<int> remaining{0};
+    unsigned long generation = 0;
+    bool stopping = false;
+
+    // own queue from the front, other queues from the back
+    bool next_task(int id, int& task_index) {
+        {
+            auto& own = *queues[id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task_index = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        int queue_count = size();
+        for (int k = 1; k < queue_count; k++) {
+            auto& victim = *queues[(id + k) % queue_count];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task_index = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(int id) {
+        unsigned long seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(state_mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen_generation; });
+                if (stopping) return;
+                seen_generation = generation;
+            }
+
+            int task_index;
+            while (next_task(id, task_index)) {
+                (*current_task)(task_index);
+                if (remaining.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(state_mutex);
+                    done.notify_all();
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "bvh.h"
+#include "hittable.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// triangles as plain data: one shared vertex array and three vertex indices per triangle,
+// so a vertex used by six triangles is stored once. what the obj loader (obj_loader.h) fills
+struct mesh_data {
+    std::vector<point3> vertices;
+    std::vector<uint32_t> indices; // 3 per triangle, into vertices
+
+    size_t triangle_count() const { return indices.size() / 3; }
+};
+
+// the part of the watertight ray/triangle test (Woop, Benthin, Wald 2013) that only
+// depends on the ray, computed once per ray instead of once per triangle.
+// the ray is turned into a shear transform that maps it onto the +z axis, after which
+// the test is whether the origin lies inside the 2d triangle in xy
+struct triangle_ray {
+    point3 origin;
+    int kx, ky, kz;    // axes, kz is the one the direction is largest along
+    real sx, sy, sz;   // the shear
+
+    explicit triangle_ray(const ray& r) : origin(r.origin()) {
+        const vec3& dir = r.direction();
+        vec3 a = abs(dir);
+        kz = a.x() > a.y() ? (a.x() > a.z() ? 0 : 2) : (a.y() > a.z() ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        if (dir[kz] < 0) std::swap(kx, ky); // keeps the winding, so the sign of det means something
+        sx = -dir[kx] / dir[kz];
+        sy = -dir[ky] / dir[kz];
+        sz = 1 / dir[kz];
+    }
+};
+
+// barycentric weights of a hit on the triangle, b[i] belongs to vertex i
+struct triangle_hit {
+    real t;
+    real b[3];
+};
+
+// watertight: an edge shared by two triangles gives both of them the exact same edge
+// function (with opposite sign), so a ray through the edge hits at least one of them and
+// never slips through a crack the way it can with moller-trumbore. both sides count as hits
+inline bool intersect_triangle(const triangle_ray& tr, const point3& p0, const point3& p1, const point3& p2,
+                               interval ray_t, triangle_hit& hit) {
+    vec3 a = p0 - tr.origin;
+    vec3 b = p1 - tr.origin;
+    vec3 c = p2 - tr.origin;
+
+    real ax = a[tr.kx] + tr.sx * a[tr.kz], ay = a[tr.ky] + tr.sy * a[tr.kz];
+    real bx = b[tr.kx] + tr.sx * b[tr.kz], by = b[tr.ky] + tr.sy * b[tr.kz];
+    real cx = c[tr.kx] + tr.sx * c[tr.kz], cy = c[tr.ky] + tr.sy * c[tr.kz];
+
+    real u = cx * by - cy * bx;
+    real v = ax * cy - ay * cx;
+    real w = bx * ay - by * ax;
+
+    // a ray right on an edge gives 0, which float rounding can get wrong. the double
+    // products of float inputs are exact, so redo them there to get the sign right
+    if constexpr (sizeof(real) == sizeof(float)) {
+        if (u == 0 || v == 0 || w == 0) {
+            u = real(double(cx) * by - double(cy) * bx);
+            v = real(double(ax) * cy - double(ay) * cx);
+            w = real(double(bx) * ay - double(by) * ax);
+        }
+    }
+
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+    real det = u + v + w;
+    if (det == 0) return false; // ray in the triangle's plane, or a degenerate triangle
+
+    real t = (u * tr.sz * a[tr.kz] + v * tr.sz * b[tr.kz] + w * tr.sz * c[tr.kz]) / det;
+    if (!ray_t.surrounds(t)) return false;
+
+    real inv_det = 1 / det;
+    hit.t = t;
+    hit.b[0] = u * inv_det;
+    hit.b[1] = v * inv_det;
+    hit.b[2] = w * inv_det;
+    return true;
+}
+
+// a mesh of triangles with one material. it owns its vertices and indices and has its own
+// bvh over the triangles, so the scene sees one object however many triangles it has:
+// per triangle that's 12 bytes of indices plus the shared vertices and about half a bvh
+// node, instead of a heap allocated hittable each
+class triangle_mesh : public hittable {
+public:
+    // takes the data over, the triangles get reordered into the bvh's leaf order
+    triangle_mesh(mesh_data data, uint32_t material_id)
+        : vertices(std::move(data.vertices)), indices(std::move(data.indices)), material_id(material_id)
+    {
+        size_t count = indices.size() / 3;
+        indices.resize(count * 3);
+
+        std::vector<aabb> boxes;
+        boxes.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            const point3& p0 = vertices[indices[3 * i]];
+            const point3& p1 = vertices[indices[3 * i + 1]];
+            const point3& p2 = vertices[indices[3 * i + 2]];
+            boxes.push_back(aabb(aabb(p0, p1), aabb(p2, p2)));
+        }
+
+        std::vector<uint32_t> ordered;
+        ordered.reserve(indices.size());
+        for (uint32_t index : tree.build(boxes)) {
+            ordered.push_back(indices[3 * index]);
+            ordered.push_back(indices[3 * index + 1]);
+            ordered.push_back(indices[3 * index + 2]);
+        }
+        indices = std::move(ordered);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        triangle_ray tr(r);
+        return tree.traverse(r, ray_t, [&](uint32_t i, interval& t) {
+            triangle_hit h;
+            RT_STAT_INC(triangle_tests);
+            if (!intersect_triangle(tr, vertex(i, 0), vertex(i, 1), vertex(i, 2), t, h)) return false;
+            RT_STAT_INC(triangle_hits);
+            rec.hit_t = h.t;
+            rec.hit_object = this;
+            rec.primitive_index = i;
+            t.max = h.t;
+            return true;
+        });
+    }
+
+    bool hit_any(const ray& r, interval ray_t) const override {
+        triangle_ray tr(r);
+        return tree.traverse_any(r, ray_t, [&](uint32_t i, interval& t) {
+            triangle_hit h;
+            RT_STAT_INC(triangle_tests);
+            return intersect_triangle(tr, vertex(i, 0), vertex(i, 1), vertex(i, 2), t, h);
+        });
+    }
+
+    // the barycentrics of the closest hit weren't kept, the same test on the same triangle
+    // gives them again (and bit for bit the same, so it can't miss now)
+    void compute_surface(const ray& r, hit_record& rec) const override {
+        uint32_t i = rec.primitive_index;
+        const point3& p0 = vertex(i, 0);
+        const point3& p1 = vertex(i, 1);
+        const point3& p2 = vertex(i, 2);
+
+        triangle_hit h;
+        if (!intersect_triangle(triangle_ray(r), p0, p1, p2, interval::universe, h))
+            h = triangle_hit{ rec.hit_t, { real(1) / 3, real(1) / 3, real(1) / 3 } };
+
+        // the point from the barycentrics is much more exact than r.at(t), its error is a
+        // few roundings of the vertex coordinates (pbrt 3.9.4)
+        rec.hit_point = h.b[0] * p0 + h.b[1] * p1 + h.b[2] * p2;
+        rec.point_error = rounding_error(7) * (abs(h.b[0] * p0) + abs(h.b[1] * p1) + abs(h.b[2] * p2));
+        rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+        rec.material_id = material_id;
+    }
+
+    aabb bounding_box() const override { return tree.bounding_box(); }
+
+    size_t triangle_count() const { return indices.size() / 3; }
+    size_t vertex_count() const { return vertices.size(); }
+    size_t node_count() const { return tree.node_count(); }
+
+private:
+    std::vector<point3> vertices;
+    std::vector<uint32_t> indices; // leaf order
+    uint32_t material_id;
+    bvh_tree tree;
+
+    const point3& vertex(uint32_t triangle, int corner) const {
+        return vertices[indices[3 * size_t(triangle) + corner]];
+    }
+};
+
+#endif
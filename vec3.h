@@ -1,6 +1,8 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include "real.h"
+
 #include <cmath>
 #include <iostream>
 
@@ -8,18 +10,18 @@
 // contains normal vector methods and some specific methods just for our ray tracer 
 class vec3 {
 public:
-    double e[3];
+    real e[3];
 
     vec3() : e{0, 0, 0} {}
-    vec3(double x_, double y_, double z_) : e{x_, y_, z_} {}
+    vec3(real x_, real y_, real z_) : e{x_, y_, z_} {}
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    real x() const { return e[0]; }
+    real y() const { return e[1]; }
+    real z() const { return e[2]; }
 
     vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int idx) const { return e[idx]; }
-    double& operator[](int idx) { return e[idx]; }
+    real operator[](int idx) const { return e[idx]; }
+    real& operator[](int idx) { return e[idx]; }
 
     vec3& operator+=(const vec3& other) {
         e[0] += other.e[0];
@@ -28,22 +30,22 @@ public:
         return *this;
     }
 
-    vec3& operator*=(double scalar) {
+    vec3& operator*=(real scalar) {
         e[0] *= scalar;
         e[1] *= scalar;
         e[2] *= scalar;
         return *this;
     }
 
-    vec3& operator/=(double divisor) {
+    vec3& operator/=(real divisor) {
         return *this *= 1 / divisor;
     }
 
-    double length() const {
+    real length() const {
         return std::sqrt(length_squared());
     }
 
-    double length_squared() const {
+    real length_squared() const {
         return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
     }
 
@@ -52,7 +54,7 @@ public:
     }
 
     // generating a random point in the space 
-    static vec3 random(double min_, double max_) {
+    static vec3 random(real min_, real max_) {
         return vec3(random_double(min_, max_), random_double(min_, max_), random_double(min_, max_));
     }
 
@@ -87,22 +89,22 @@ inline vec3 operator*(const vec3& a, const vec3& b) {
 }
 
 // scalar multiply (scalar * vec)
-inline vec3 operator*(double scale, const vec3& v) {
+inline vec3 operator*(real scale, const vec3& v) {
     return vec3(scale * v.e[0], scale * v.e[1], scale * v.e[2]);
 }
 
 // scalar multiply (vec * scalar)
-inline vec3 operator*(const vec3& v, double scale) {
+inline vec3 operator*(const vec3& v, real scale) {
     return scale * v;
 }
 
 // divide by scalar
-inline vec3 operator/(const vec3& v, double divisor) {
+inline vec3 operator/(const vec3& v, real divisor) {
     return (1 / divisor) * v;
 }
 
 // dot product
-inline double dot(const vec3& a, const vec3& b) {
+inline real dot(const vec3& a, const vec3& b) {
     return a.e[0]*b.e[0] + a.e[1]*b.e[1] + a.e[2]*b.e[2];
 }
 
@@ -120,22 +122,50 @@ inline vec3 unit_vector(const vec3& v) {
     return v / v.length();
 }
 
+// component wise absolute value
+inline vec3 abs(const vec3& v) {
+    return vec3(std::fabs(v.x()), std::fabs(v.y()), std::fabs(v.z()));
+}
+
+// point in the unit disk for u, v uniform in [0,1), uniform over the disk: the concentric
+// mapping (Shirley and Chiu 1997) squeezes squares around the center into rings, so
+// stratified points stay stratified and nothing gets rejected
+inline vec3 disk_from_square(double u, double v) {
+    double a = 2 * u - 1, b = 2 * v - 1;
+    if (a == 0 && b == 0) return vec3(0, 0, 0);
+    double r, phi;
+    if (std::fabs(a) > std::fabs(b)) {
+        r = a;
+        phi = (pi / 4) * (b / a);
+    } else {
+        r = b;
+        phi = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(real(r * std::cos(phi)), real(r * std::sin(phi)), 0);
+}
+
+// unit vector for u, v uniform in [0,1), uniform over the sphere: z is uniform in [-1, 1]
+// (Archimedes' hat box theorem) and the angle around z uniform
+inline vec3 sphere_from_square(double u, double v) {
+    double z = 1 - 2 * u;
+    double r = std::sqrt(std::fmax(0.0, 1 - z * z));
+    double phi = 2 * pi * v;
+    return vec3(real(r * std::cos(phi)), real(r * std::sin(phi)), real(z));
+}
+
 // this is to alter the properties of camera 
-// gives random point inside unit disk (for defocus blur etc.)
+// gives random point inside unit disk (for defocus blur etc.), from the sample's sampler
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto pt = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-        if (pt.length_squared() < 1) return pt;
-    }
+    double u, v;
+    thread_sampler().next_2d(u, v);
+    return disk_from_square(u, v);
 }
 
-// gives random unit length vector (uniformly distributed)
+// gives random unit length vector (uniformly distributed), from the sample's sampler
 inline vec3 random_unit_vector() {
-    while (true) {
-        auto rand_vec = vec3::random(-1, 1);
-        auto mag_sq = rand_vec.length_squared();
-        if (mag_sq > 1e-160 && mag_sq <= 1) return rand_vec / std::sqrt(mag_sq);
-    }
+    double u, v;
+    thread_sampler().next_2d(u, v);
+    return sphere_from_square(u, v);
 }
 
 // returns vector in same hemisphere as normal
@@ -150,7 +180,7 @@ inline vec3 reflect(const vec3& incident, const vec3& normal) {
 }
 
 // calculate refraction vector based on Snell's Law
-inline vec3 refract(const vec3& uv, const vec3& normal, double eta_ratio) {
+inline vec3 refract(const vec3& uv, const vec3& normal, real eta_ratio) {
     auto cos_theta = std::fmin(dot(-uv, normal), 1.0);
     vec3 perp = eta_ratio * (uv + cos_theta * normal);
     vec3 parallel = -std::sqrt(std::fabs(1.0 - perp.length_squared())) * normal;
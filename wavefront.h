@@ -0,0 +1,136 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "aligned_vector.h"
+#include "color.h"
+#include "denoise.h"
+#include "hittable.h"
+#include "light.h"
+#include "ray.h"
+#include "rng.h"
+#include "sampler.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// buffers of the wavefront integrator (camera, integrator::wavefront). instead of following
+// one path to its end before starting the next, a whole batch of paths goes through one
+// stage at a time: generate, intersect, bin by material, scatter, compact. every stage is
+// a plain loop over contiguous arrays, and binning makes the scatter stage call the same
+// kind of material many times in a row instead of jumping between lambertian, metal and
+// dielectric. the bins are the material types, and the material ids inside a type, so
+// hits on one material still come together
+
+// the live paths of a batch as structure of arrays
+struct path_queue {
+    aligned_vector<real> origin_x, origin_y, origin_z;
+    aligned_vector<real> dir_x, dir_y, dir_z;
+    aligned_vector<real> weight_r, weight_g, weight_b; // throughput so far
+    aligned_vector<real> from_x, from_y, from_z, from_pdf; // path_vertex the ray left from
+    std::vector<uint32_t> path_id; // where the path's result goes in the batch
+    std::vector<pcg32> rng; // every path keeps its own generator between the stages
+    std::vector<sample_cursor> sampler; // and its place in the sampler's dimensions
+
+    size_t size() const { return path_id.size(); }
+
+    void clear() {
+        origin_x.clear(); origin_y.clear(); origin_z.clear();
+        dir_x.clear(); dir_y.clear(); dir_z.clear();
+        weight_r.clear(); weight_g.clear(); weight_b.clear();
+        from_x.clear(); from_y.clear(); from_z.clear(); from_pdf.clear();
+        path_id.clear();
+        rng.clear();
+        sampler.clear();
+    }
+
+    void push(const ray& r, const color& weight, const path_vertex& from, uint32_t id, const pcg32& generator,
+              const sample_cursor& cursor) {
+        origin_x.push_back(r.origin().x());
+        origin_y.push_back(r.origin().y());
+        origin_z.push_back(r.origin().z());
+        dir_x.push_back(r.direction().x());
+        dir_y.push_back(r.direction().y());
+        dir_z.push_back(r.direction().z());
+        weight_r.push_back(weight.x());
+        weight_g.push_back(weight.y());
+        weight_b.push_back(weight.z());
+        from_x.push_back(from.point.x());
+        from_y.push_back(from.point.y());
+        from_z.push_back(from.point.z());
+        from_pdf.push_back(from.pdf);
+        path_id.push_back(id);
+        rng.push_back(generator);
+        sampler.push_back(cursor);
+    }
+
+    ray path_ray(size_t i) const {
+        return ray(point3(origin_x[i], origin_y[i], origin_z[i]), vec3(dir_x[i], dir_y[i], dir_z[i]));
+    }
+
+    color weight(size_t i) const { return color(weight_r[i], weight_g[i], weight_b[i]); }
+
+    path_vertex vertex(size_t i) const { return path_vertex{ point3(from_x[i], from_y[i], from_z[i]), from_pdf[i] }; }
+};
+
+// scratch space of one thread, reused from batch to batch so nothing is allocated per tile
+struct wavefront_batch {
+    path_queue current, next;
+    std::vector<color> results;         // radiance of every path of a sample batch, by path_id
+    std::vector<color> pixel_sums;      // sum of the finished sample batches of every pixel
+    std::vector<feature_sample> features;     // like results, empty unless the render notes features
+    std::vector<feature_sum> pixel_features;  // like pixel_sums
+    std::vector<hit_record> hits;       // closest hit of current[i]
+    std::vector<uint32_t> hit_paths;    // indices into current of the paths that hit something
+    std::vector<uint32_t> keys;         // material id of every hit_paths entry
+    std::vector<uint32_t> types;        // material type of every hit_paths entry
+    std::vector<uint32_t> order;        // hit_paths entries ordered by type and material
+    std::vector<uint32_t> by_key;       // hit_paths entries ordered by material only
+    std::vector<uint32_t> key_counts;
+};
+
+// order = indices of keys sorted by key, stable. material ids are small and dense, so a
+// counting sort (one pass to count, one to place) beats a comparison sort easily
+inline void sort_by_key(const std::vector<uint32_t>& keys, std::vector<uint32_t>& order,
+                        std::vector<uint32_t>& counts) {
+    uint32_t max_key = 0;
+    for (uint32_t k : keys) max_key = k > max_key ? k : max_key;
+
+    counts.assign(size_t(max_key) + 1, 0);
+    for (uint32_t k : keys) counts[k]++;
+
+    uint32_t start = 0;
+    for (auto& c : counts) {
+        uint32_t n = c;
+        c = start;
+        start += n;
+    }
+
+    order.resize(keys.size());
+    for (uint32_t i = 0; i < keys.size(); i++) order[counts[keys[i]]++] = i;
+}
+
+// order = indices sorted by type, and by key within a type, stable. sorted by key first,
+// then a second counting sort by type (only a few of them) that keeps that order
+inline void sort_by_type_and_key(const std::vector<uint32_t>& types, const std::vector<uint32_t>& keys,
+                                 std::vector<uint32_t>& order, std::vector<uint32_t>& by_key,
+                                 std::vector<uint32_t>& counts) {
+    sort_by_key(keys, by_key, counts);
+
+    uint32_t max_type = 0;
+    for (uint32_t t : types) max_type = t > max_type ? t : max_type;
+    counts.assign(size_t(max_type) + 1, 0);
+    for (uint32_t t : types) counts[t]++;
+
+    uint32_t start = 0;
+    for (auto& c : counts) {
+        uint32_t n = c;
+        c = start;
+        start += n;
+    }
+
+    order.resize(by_key.size());
+    for (uint32_t i : by_key) order[counts[types[i]]++] = i;
+}
+
+#endif